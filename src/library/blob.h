@@ -20,9 +20,13 @@ public:
         row({std::nullopt, data})
     {}
 
-    explicit Blob(Database &db, const QSqlRecord &r) :
+    explicit Blob(Database &db, Row &&data) :
         Object(db),
-        row(qsql_unpack_record<Table>(r))
+        row(std::move(data))
+    {}
+
+    explicit Blob(Database &db, const QSqlQuery &q) :
+        Blob(db, qsql_unpack_query<Table>(q))
     {}
 
     QImage toImage();
@@ -1,46 +1,60 @@
 #include "book.h"
+#include "bookstats.h"
 #include "chapter.h"
+#include "progress.h"
 
 namespace Midoku::Library {
 
 DB_OBJECT_IMPL(Book)
 
+void Book::recordTriggered(ChangeFeed &feed, const RowChange &change, const Row &) {
+    // Stats are created along with the book
+    if (change.kind == RowChange::Inserted)
+        feed.record<BookStats::Table>(change.id, RowChange::Inserted);
+}
+
 DBResult<std::vector<std::unique_ptr<Chapter>>> Book::getChapters() {
     return database().select<Chapter>(Chapter::book_id == getId());
 }
 
 QVariantList Book::getChaptersV() {
-   return getChapters().map([] (std::vector<std::unique_ptr<Chapter>> &&r) {
-       QVariantList l;
-       l.reserve(r.size());
-       std::for_each(std::move_iterator(r.begin()), std::move_iterator(r.end()), [&l](auto &&chap) {
-           l.append(QVariant::fromValue(chap.release()));
-       });
-       return l;
-   }).value_or(QVariantList());
+    followChanges();
+    return m_chapters.get(this, [this] () {
+        return getChapters().map([] (std::vector<std::unique_ptr<Chapter>> &&r) {
+            QVariantList l;
+            l.reserve(r.size());
+            std::for_each(std::move_iterator(r.begin()), std::move_iterator(r.end()), [&l](auto &&chap) {
+                l.append(QVariant::fromValue(chap.release()));
+            });
+            return QVariant(l);
+        });
+    }).toList();
 }
 
 DBResult<long> Book::getChapterCount() {
     using namespace Util::ORM;
-    return database().exec(Util::ORM::select(Sel::From(Chapter::table, Expr::count()), Chapter::book_id == getId()))
-            .bind([] (QSqlQuery &&q) -> DBResult<long> {
-        if (q.next())
-            return Ok(q.value(0).toInt());
+    return database().selectOne(Util::ORM::select(Sel::From(Chapter::table, Expr::count()), Chapter::book_id == getId()))
+            .bind([] (std::optional<std::tuple<long>> &&r) -> DBResult<long> {
+        if (r)
+            return Ok(std::get<0>(r.value()));
         else
             return Err(QSqlError("count() didn't return anything"));
     });
 }
 
 QVariant Book::getChapterCountV() {
-    return getChapterCount().map([] (long x) {return QVariant::fromValue(x);}).value_or(QVariant());
+    followChanges();
+    return m_chapter_count.get(this, [this] () {
+        return getChapterCount().map([] (long x) {return QVariant::fromValue(x);});
+    });
 }
 
 DBResult<long> Book::getTotalTime() {
     using namespace Util::ORM;
-    return database().exec(Util::ORM::select(Sel::From(Chapter::table, Expr::sum(Chapter::length)), Chapter::book_id == getId()))
-            .bind([] (QSqlQuery &&q) -> DBResult<long> {
-        if (q.next())
-            return Ok(q.value(0).toInt());
+    return database().selectOne(Util::ORM::select(Sel::From(Chapter::table, Expr::sum(Chapter::length)), Chapter::book_id == getId()))
+            .bind([] (std::optional<std::tuple<long>> &&r) -> DBResult<long> {
+        if (r)
+            return Ok(std::get<0>(r.value()));
         else
             return Err(QSqlError("Sum didn't return anything"));
     });
@@ -57,45 +71,48 @@ DBResult<std::unique_ptr<Chapter>> Book::getFirstChapter() {
 }
 
 QVariant Book::getFirstChapterV() {
-    return result_to_variant(getFirstChapter());
+    followChanges();
+    return m_first_chapter.get(this, [this] () {
+        return getFirstChapter().map([] (std::unique_ptr<Chapter> &&chap) {
+            return QVariant::fromValue(chap.release());
+        });
+    });
 }
 
 DBResult<std::unique_ptr<Chapter>> Book::getChapterAt(long time) {
     using namespace Util::ORM;
-    return database().exec(Util::ORM::select(
-                               Sel::From(Chapter::table, Chapter::id, Chapter::chapter, Chapter::length),
+    return database().rows(Util::ORM::select(
+                               Sel::Columns(Chapter::table, Chapter::id, Chapter::length),
                                Chapter::book_id == getId(),
                                Sel::OrderBy(Chapter::chapter)))
-            .bind([this, &time] (QSqlQuery &&q) -> DBResult<std::unique_ptr<Chapter>> {
-        while (q.next()) {
-            long len = q.value(2).toInt();
-            qDebug() << len;
-            if (time < len) {
-                return database().load<Chapter>(q.value(0).toInt());
-            }
+            .bind([this, &time] (auto &&chapters) -> DBResult<std::unique_ptr<Chapter>> {
+        for (auto &[id, len] : chapters) {
+            if (time < len)
+                return database().load<Chapter>(id.value());
             time -= len;
         }
 
-        return Err(QSqlError("Timestamp past end of book"));
+        return chapters.status().bind([] () -> DBResult<std::unique_ptr<Chapter>> {
+            return Err(QSqlError("Timestamp past end of book"));
+        });
     });
 }
 
 DBResult<std::pair<std::unique_ptr<Chapter>, int64_t>> Book::getChapterAt2(long time) {
     using namespace Util::ORM;
-    return database().exec(Util::ORM::select(Chapter::table,
-                                             Chapter::book_id == getId(),
-                                             Sel::OrderBy(Chapter::chapter)))
-            .bind([this, &time] (QSqlQuery &&q) -> DBResult<std::pair<std::unique_ptr<Chapter>, int64_t>> {
-        while (q.next()) {
-            long len = q.value(Chapter::table.column_index(Chapter::length)).toInt();
-            qDebug() << len;
-            if (time < len) {
-                return Ok(std::pair{std::make_unique<Chapter>(database(), q.record()), time});
-            }
+    return Chapter::cursor(database(), Chapter::book_id == getId(), Sel::OrderBy(Chapter::chapter))
+            .bind([this, &time] (Cursor<Chapter::Table> &&chapters) -> DBResult<std::pair<std::unique_ptr<Chapter>, int64_t>> {
+        // Only the chapter we stop at becomes an object
+        for (auto &row : chapters) {
+            long len = row.get(Chapter::length);
+            if (time < len)
+                return Ok(std::pair{Chapter::materialize(database(), std::move(row)), time});
             time -= len;
         }
 
-        return Err(QSqlError("Timestamp past end of book"));
+        return chapters.status().bind([] () -> DBResult<std::pair<std::unique_ptr<Chapter>, int64_t>> {
+            return Err(QSqlError("Timestamp past end of book"));
+        });
     });
 }
 
@@ -113,4 +130,35 @@ DBResult<QImage> Book::getCover() {
     });
 }
 
+// ---------------
+void Book::followChanges() {
+    if (following_changes)
+        return;
+    following_changes = true;
+    connect(&database().changes(), &ChangeFeed::rowsChanged, this, &Book::onRowsChanged);
+}
+
+void Book::onRowsChanged(const QVector<RowChange> &changes) {
+    bool chapters = false;
+    bool progress = false;
+    for (const auto &c : changes) {
+        // Chapters are only written on import, don't bother checking which book
+        if (c.is(Chapter::table))
+            chapters = true;
+        // Playback keeps updating the book's most recent row
+        else if (c.is(Progress::table))
+            progress = progress || c.kind != RowChange::Updated || c.id == m_most_recent_progress_id;
+    }
+
+    if (chapters) {
+        bool had_any = m_chapters.reset();
+        had_any = m_chapter_count.reset() || had_any;
+        had_any = m_first_chapter.reset() || had_any;
+        if (had_any)
+            emit chaptersChanged();
+    }
+    if (progress && m_most_recent_progress.reset())
+        emit progressChanged();
+}
+
 }
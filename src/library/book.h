@@ -2,6 +2,7 @@
 
 #include "database.h"
 #include "blob.h"
+#include "memo.h"
 
 
 namespace Midoku::Library {
@@ -23,10 +24,24 @@ class Book : public Object<Book>
 
     friend class Object<Book>;
 
-    Q_PROPERTY(QVariantList chapters READ getChaptersV)
-    Q_PROPERTY(QVariant chapterCount READ getChapterCountV)
-    Q_PROPERTY(QVariant firstChapter READ getFirstChapterV)
-    Q_PROPERTY(QVariant mostRecentProgress READ getMostRecentProgressV)
+    Q_PROPERTY(QVariantList chapters READ getChaptersV NOTIFY chaptersChanged)
+    Q_PROPERTY(QVariant chapterModel READ getChapterModelV CONSTANT)
+    Q_PROPERTY(QVariant chapterCount READ getChapterCountV NOTIFY chaptersChanged)
+    Q_PROPERTY(QVariant firstChapter READ getFirstChapterV NOTIFY chaptersChanged)
+    Q_PROPERTY(QVariant mostRecentProgress READ getMostRecentProgressV NOTIFY progressChanged)
+
+    // Property values for QML, reset by writes reported on the change feed
+    Memo m_chapters;
+    Memo m_chapter_count;
+    Memo m_first_chapter;
+    Memo m_most_recent_progress;
+    long m_most_recent_progress_id = -1;
+    // Follows the feed by itself, never reset
+    Memo m_chapter_model;
+    bool following_changes = false;
+
+    void followChanges();
+    void onRowsChanged(const QVector<RowChange> &changes);
 
 public:
     ORM_COLUMN(QString, title, Util::ORM::NotNull);
@@ -37,6 +52,9 @@ public:
     DB_OBJECT(Book, "Book", title, author, reader, cover_blob_id,
               Util::ORM::ForeignKey(cover_blob_id, Util::ORM::References(Blob::table, Blob::id)));
 
+    // BookStats rows written along with this one, see Object::recordTriggered()
+    static void recordTriggered(ChangeFeed &feed, const RowChange &change, const Row &row);
+
 
     explicit Book(Database &db, QString title, QString author = QString(), QString reader = QString(),
                   Blob *cover = nullptr) :
@@ -44,14 +62,22 @@ public:
         row({std::nullopt, title, author, reader, cover? std::optional(cover->getId()) : std::nullopt})
     {}
 
-    explicit Book(Database &db, const QSqlRecord &r) :
+    explicit Book(Database &db, Row &&data) :
         Object(db),
-        row(qsql_unpack_record<Table>(r))
+        row(std::move(data))
+    {}
+
+    explicit Book(Database &db, const QSqlQuery &q) :
+        Book(db, qsql_unpack_query<Table>(q))
     {}
 
     DBResult<std::vector<std::unique_ptr<Chapter>>> getChapters();
     Q_INVOKABLE QVariantList getChaptersV();
 
+    // See models.cpp
+    // Chapters in order, fetched as the view scrolls
+    Q_INVOKABLE QVariant getChapterModelV();
+
     DBResult<long> getChapterCount();
     Q_INVOKABLE QVariant getChapterCountV();
 
@@ -72,6 +98,10 @@ public:
 
     DBResult<std::unique_ptr<Progress>> getProgress();
     Q_INVOKABLE QVariant getProgressV();
+
+signals:
+    void chaptersChanged();
+    void progressChanged();
 };
 
 DB_OBJECT_POST(Book);
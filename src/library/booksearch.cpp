@@ -0,0 +1,72 @@
+#include "booksearch.h"
+
+#include <QStringList>
+
+using Midoku::Util::ORM::SQL;
+
+namespace Midoku::Library {
+
+// Prefix indexes keep queries for partially typed words fast
+SQL<> BookSearch::sqlCreateTable() {
+    return SQL<>(QStringLiteral("CREATE VIRTUAL TABLE IF NOT EXISTS BookSearch "
+                                "USING fts5(title, author, reader, chapters, prefix = '2 3');"));
+}
+
+// Recompute the chapters column of a book
+static QString chapters_update(const QString &book_id) {
+    return QStringLiteral("UPDATE BookSearch SET chapters = "
+                          "(SELECT coalesce(group_concat(title, ' '), '') FROM Chapter WHERE book_id = %1) "
+                          "WHERE rowid = %1;").arg(book_id);
+}
+
+std::vector<SQL<>> BookSearch::sqlCreateTriggers() {
+    auto trigger = [] (const char *name, const char *event, const QString &body) {
+        return SQL<>(QStringLiteral("CREATE TRIGGER IF NOT EXISTS BookSearch_%1 AFTER %2 BEGIN %3 END;")
+                     .arg(QLatin1String(name), QLatin1String(event), body));
+    };
+
+    return {
+        trigger("book_insert", "INSERT ON Book",
+                QStringLiteral("INSERT INTO BookSearch (rowid, title, author, reader, chapters) "
+                               "VALUES (NEW.id, NEW.title, NEW.author, NEW.reader, '');")),
+        trigger("book_update", "UPDATE OF title, author, reader ON Book",
+                QStringLiteral("UPDATE BookSearch SET title = NEW.title, author = NEW.author, reader = NEW.reader "
+                               "WHERE rowid = NEW.id;")),
+        trigger("book_delete", "DELETE ON Book",
+                QStringLiteral("DELETE FROM BookSearch WHERE rowid = OLD.id;")),
+
+        // Imports add chapters one by one, append instead of recomputing
+        trigger("chapter_insert", "INSERT ON Chapter",
+                QStringLiteral("UPDATE BookSearch SET chapters = chapters || ' ' || coalesce(NEW.title, '') "
+                               "WHERE rowid = NEW.book_id;")),
+        trigger("chapter_delete", "DELETE ON Chapter", chapters_update("OLD.book_id")),
+        trigger("chapter_update", "UPDATE OF book_id, title ON Chapter",
+                chapters_update("OLD.book_id") + chapters_update("NEW.book_id")),
+    };
+}
+
+std::vector<SQL<>> BookSearch::sqlRebuild() {
+    return {
+        SQL<>(QStringLiteral("DELETE FROM BookSearch;")),
+        SQL<>(QStringLiteral(
+            "INSERT INTO BookSearch (rowid, title, author, reader, chapters) "
+            "SELECT b.id, b.title, b.author, b.reader, "
+            "(SELECT coalesce(group_concat(c.title, ' '), '') FROM Chapter c WHERE c.book_id = b.id) "
+            "FROM Book b;")),
+    };
+}
+
+QString BookSearch::matchQuery(const QString &text) {
+    auto simple = text.simplified();
+    if (simple.isEmpty())
+        return QString();
+
+    auto words = simple.split(QLatin1Char(' '));
+    // Quote every word so FTS5 syntax typed by the user is taken literally
+    for (auto &word : words)
+        word = QLatin1Char('"') + word.replace(QLatin1Char('"'), QLatin1String("\"\"")) + QLatin1Char('"');
+    words.last() += QLatin1Char('*');
+    return words.join(QLatin1Char(' '));
+}
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "database.h"
+
+#include <vector>
+
+
+namespace Midoku::Library {
+
+/**
+ * @brief FTS5 index over the text of each Book, the rowid is the Book id
+ * A virtual table, so not an Object: created by sqlCreateTable(), kept current by
+ * triggers on Book and Chapter and only ever queried. The table description is
+ * for building those queries.
+ */
+class BookSearch
+{
+public:
+    ORM_COLUMN(long, rowid);
+    ORM_COLUMN(QString, title);
+    ORM_COLUMN(QString, author);
+    ORM_COLUMN(QString, reader);
+    // Titles of all chapters, space separated
+    ORM_COLUMN(QString, chapters);
+
+    using Table = Util::ORM::Table<TSTR("BookSearch"), std::decay_t<decltype(rowid)>, std::decay_t<decltype(title)>,
+                                   std::decay_t<decltype(author)>, std::decay_t<decltype(reader)>,
+                                   std::decay_t<decltype(chapters)>>;
+    static constexpr Table table = {};
+
+    static Util::ORM::SQL<> sqlCreateTable();
+
+    /**
+     * @brief CREATE TRIGGER statements keeping the index current
+     */
+    static std::vector<Util::ORM::SQL<>> sqlCreateTriggers();
+
+    /**
+     * @brief Reindex all books from scratch
+     */
+    static std::vector<Util::ORM::SQL<>> sqlRebuild();
+
+    /**
+     * @brief Turn text typed by the user into an FTS5 query
+     * Every word must appear, the last one may be incomplete.
+     * @return An empty string if there is nothing to search for
+     */
+    static QString matchQuery(const QString &text);
+};
+
+}
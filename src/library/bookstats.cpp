@@ -0,0 +1,73 @@
+#include "bookstats.h"
+
+using Midoku::Util::ORM::SQL;
+
+namespace Midoku::Library {
+DB_OBJECT_IMPL(BookStats);
+
+// State after total_length changes by delta, unplayed books stay New
+static QString state_for_length(const QString &delta) {
+    return QStringLiteral("CASE WHEN state = %1 THEN %1 WHEN position + %2 >= total_length + %3 THEN %4 ELSE %5 END")
+            .arg(BookStats::New).arg(BookStats::finished_margin).arg(delta)
+            .arg(BookStats::Finished).arg(BookStats::Started);
+}
+
+// Move the counts of a chapter in or out of a book
+static QString chapter_update(const QString &sign, const QString &row) {
+    return QStringLiteral("UPDATE BookStats SET chapter_count = chapter_count %1 1, total_length = total_length %1 %2.length, "
+                          "state = %3 WHERE id = %2.book_id;")
+            .arg(sign, row, state_for_length(sign + QStringLiteral(" ") + row + QStringLiteral(".length")));
+}
+
+// Only progress at least as recent as the current one moves the position
+static QString progress_update() {
+    return QStringLiteral(
+        "UPDATE BookStats SET "
+            "position = NEW.time + (SELECT coalesce(sum(c.length), 0) FROM Chapter p "
+                "JOIN Chapter c ON c.book_id = p.book_id AND c.chapter < p.chapter WHERE p.id = NEW.chapter_id), "
+            "last_played = datetime(NEW.timestamp) "
+        "WHERE id = NEW.book_id AND (last_played IS NULL OR datetime(NEW.timestamp) >= last_played);"
+        "UPDATE BookStats SET state = CASE WHEN position + %1 >= total_length THEN %2 ELSE %3 END "
+        "WHERE id = NEW.book_id AND last_played IS NOT NULL;")
+            .arg(BookStats::finished_margin).arg(BookStats::Finished).arg(BookStats::Started);
+}
+
+std::vector<SQL<>> BookStats::sqlCreateTriggers() {
+    auto trigger = [] (const char *name, const char *event, const QString &body) {
+        return SQL<>(QStringLiteral("CREATE TRIGGER IF NOT EXISTS BookStats_%1 AFTER %2 BEGIN %3 END;")
+                     .arg(QLatin1String(name), QLatin1String(event), body));
+    };
+
+    return {
+        trigger("book_insert", "INSERT ON Book",
+                QStringLiteral("INSERT INTO BookStats (id, chapter_count, total_length, position, last_played, state) "
+                               "VALUES (NEW.id, 0, 0, 0, NULL, %1);").arg(New)),
+        trigger("book_delete", "DELETE ON Book",
+                QStringLiteral("DELETE FROM BookStats WHERE id = OLD.id;")),
+
+        trigger("chapter_insert", "INSERT ON Chapter", chapter_update("+", "NEW")),
+        trigger("chapter_delete", "DELETE ON Chapter", chapter_update("-", "OLD")),
+        trigger("chapter_update", "UPDATE OF book_id, length ON Chapter",
+                chapter_update("-", "OLD") + chapter_update("+", "NEW")),
+
+        trigger("progress_insert", "INSERT ON Progress", progress_update()),
+        trigger("progress_update", "UPDATE OF book_id, chapter_id, time, timestamp ON Progress", progress_update()),
+    };
+}
+
+std::vector<SQL<>> BookStats::sqlRebuild() {
+    return {
+        SQL<>(QStringLiteral("DELETE FROM BookStats;")),
+        SQL<>(QStringLiteral(
+            "INSERT INTO BookStats (id, chapter_count, total_length, position, last_played, state) "
+            "SELECT b.id, count(c.id), coalesce(sum(c.length), 0), 0, NULL, %1 "
+            "FROM Book b LEFT JOIN Chapter c ON c.book_id = b.id GROUP BY b.id;").arg(New)),
+        // Replay the most recent progress of each book through the trigger
+        SQL<>(QStringLiteral(
+            "UPDATE Progress SET timestamp = timestamp WHERE id IN "
+            "(SELECT id FROM Progress p WHERE NOT EXISTS (SELECT 1 FROM Progress q "
+            "WHERE q.book_id = p.book_id AND datetime(q.timestamp) > datetime(p.timestamp)));")),
+    };
+}
+
+}
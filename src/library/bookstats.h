@@ -0,0 +1,72 @@
+#pragma once
+
+#include "database.h"
+#include "book.h"
+
+#include <vector>
+
+
+namespace Midoku::Library {
+
+/**
+ * @brief Per-book totals and listening state, one row per Book with the same id
+ * Maintained by SQL triggers on Book, Chapter and Progress, see sqlCreateTriggers().
+ * Never written through the ORM.
+ */
+class BookStats : public Object<BookStats>
+{
+public:
+    enum State : long {
+        New = 0,
+        Started = 1,
+        Finished = 2,
+    };
+
+    // A book counts as finished this close to the end, in seconds
+    static constexpr long finished_margin = 60;
+
+    ORM_COLUMN(long, chapter_count, Util::ORM::NotNull);
+    ORM_COLUMN(long, total_length, Util::ORM::NotNull);
+    // Offset of the most recent progress from the start of the book
+    ORM_COLUMN(long, position, Util::ORM::NotNull);
+    // datetime() of the most recent progress, NULL if never played
+    ORM_COLUMN(QString, last_played);
+    ORM_COLUMN(long, state, Util::ORM::NotNull);
+
+    DB_OBJECT(BookStats, "BookStats", chapter_count, total_length, position, last_played, state,
+              Util::ORM::ForeignKey(id, Util::ORM::References(Book::table, Book::id)),
+              Util::ORM::Index("state_recent"_T, state, last_played));
+
+
+    explicit BookStats(Database &db, Row &&data) :
+        Object(db),
+        row(std::move(data))
+    {}
+
+    explicit BookStats(Database &db, const QSqlQuery &q) :
+        BookStats(db, qsql_unpack_query<Table>(q))
+    {}
+
+    /**
+     * @brief Record an update the triggers made to book's row
+     * @param cols  The columns it may have changed
+     */
+    template <typename... Cols>
+    static void recordUpdate(ChangeFeed &feed, long book, Cols...) {
+        feed.record<Table>(book, RowChange::Updated, ((quint64(1) << Table::template column_index<Cols>()) | ...));
+    }
+
+    /**
+     * @brief CREATE TRIGGER statements keeping the table current
+     */
+    static std::vector<Util::ORM::SQL<>> sqlCreateTriggers();
+
+    /**
+     * @brief Recompute all rows from scratch, e.g. after creating the table
+     */
+    static std::vector<Util::ORM::SQL<>> sqlRebuild();
+};
+
+DB_OBJECT_POST(BookStats);
+
+}
@@ -0,0 +1,47 @@
+#include "changefeed.h"
+
+
+namespace Midoku::Library {
+
+ChangeFeed::ChangeFeed(QObject *parent) :
+    QObject(parent)
+{
+    // Feeds of worker connections are forwarded across threads
+    qRegisterMetaType<QVector<RowChange>>("QVector<Midoku::Library::RowChange>");
+}
+
+void ChangeFeed::record(RowChange change)
+{
+    pending.append(std::move(change));
+    if (marks.empty())
+        publish();
+}
+
+void ChangeFeed::beginTransaction()
+{
+    marks.push_back(pending.size());
+}
+
+void ChangeFeed::endTransaction(bool commit)
+{
+    int mark = marks.back();
+    marks.pop_back();
+
+    if (!commit)
+        pending.resize(mark);
+    else if (marks.empty())
+        publish();
+}
+
+void ChangeFeed::publish()
+{
+    if (pending.isEmpty())
+        return;
+
+    // Slots may write and record new changes
+    auto changes = std::move(pending);
+    pending.clear();
+    emit rowsChanged(changes);
+}
+
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "../util/orm.h"
+
+#include <vector>
+
+#include <QMetaType>
+#include <QObject>
+#include <QString>
+#include <QVector>
+
+
+namespace Midoku::Library {
+
+/**
+ * @brief A committed write to one row
+ */
+struct RowChange {
+    enum Kind {
+        Inserted,
+        Updated,
+        Deleted,
+    };
+
+    QString table;
+    long id = -1;
+    Kind kind = Updated;
+    // Bit i is set if column i of the table was written, all bits for inserts and deletes
+    quint64 columns = 0;
+
+    template <typename Table>
+    bool is(Table) const {
+        return table == Table::getName();
+    }
+
+    /**
+     * @brief Whether col of table was written, e.g. c.changed(Book::table, Book::title)
+     */
+    template <typename Table, typename Col>
+    bool changed(Table t, Col) const {
+        return is(t) && (columns >> Table::template column_index<Col>()) & 1;
+    }
+};
+
+/**
+ * @brief Publishes the rows written through a Database once they are committed
+ * Writes outside of a transaction are published right away. Inside one they are held
+ * back until the outermost COMMIT, and dropped when rolled back, also to a savepoint.
+ * Only writes through the ORM are recorded, not those made by triggers or plain SQL.
+ */
+class ChangeFeed : public QObject
+{
+    Q_OBJECT
+
+    QVector<RowChange> pending;
+    // Size of pending when each open transaction began, innermost last
+    std::vector<int> marks;
+
+    void publish();
+
+public:
+    explicit ChangeFeed(QObject *parent = nullptr);
+
+    void record(RowChange change);
+
+    template <typename Table>
+    void record(long id, RowChange::Kind kind, quint64 columns = ~quint64(0) >> (64 - Table::Columns::size)) {
+        record(RowChange{Table::getName(), id, kind, columns});
+    }
+
+    // Called by Database::begin() and Transaction
+    void beginTransaction();
+    void endTransaction(bool commit);
+
+signals:
+    void rowsChanged(const QVector<Midoku::Library::RowChange> &changes);
+};
+
+}
+
+Q_DECLARE_METATYPE(Midoku::Library::RowChange)
@@ -1,9 +1,18 @@
 #include "chapter.h"
+#include "bookstats.h"
 
 namespace Midoku::Library {
 
 DB_OBJECT_IMPL(Chapter)
 
+void Chapter::recordTriggered(ChangeFeed &feed, const RowChange &change, const Row &row) {
+    if (change.kind == RowChange::Updated && !change.changed(table, book_id) && !change.changed(table, length))
+        return;
+    // Moving a chapter out of a book changes that one too, but it is unknown here
+    BookStats::recordUpdate(feed, std::get<Table::column_index<std::decay_t<decltype(book_id)>>()>(row),
+                            BookStats::chapter_count, BookStats::total_length, BookStats::state);
+}
+
 
 Chapter::Chapter(Database &db, const Book &b, long chap, long length,
                  QString media, long media_offset, std::optional<long> media_chapter, QString title,
@@ -12,9 +21,13 @@ Chapter::Chapter(Database &db, const Book &b, long chap, long length,
     row({std::nullopt, b.getId(), chap, length, media, media_offset, media_chapter, title, cover? std::optional(cover->getId()) : std::nullopt})
 {}
 
-Chapter::Chapter(Database &db, const QSqlRecord &r) :
+Chapter::Chapter(Database &db, Row &&data) :
     Object(db),
-    row(qsql_unpack_record<Table>(r))
+    row(std::move(data))
+{}
+
+Chapter::Chapter(Database &db, const QSqlQuery &q) :
+    Chapter(db, qsql_unpack_query<Table>(q))
 {}
 
 
@@ -27,54 +40,74 @@ QVariant Chapter::getBookV() {
 }
 
 DBResult<std::optional<std::unique_ptr<Chapter>>> Chapter::getNextChapter() {
-    using namespace Util::ORM;
-    return database().select<Chapter>(book_id == get(book_id) && chapter > get(chapter), Sel::OrderBy(Chapter::chapter, false), Sel::Limit(1))
-            .map([] (std::vector<std::unique_ptr<Chapter>> &&cs) -> std::optional<std::unique_ptr<Chapter>> {
-        if (cs.size() > 0)
-            return std::move(cs[0]);
+    return findNextRow(database(), get(book_id), get(chapter))
+            .map([this] (std::optional<Row> &&row) -> std::optional<std::unique_ptr<Chapter>> {
+        if (row)
+            return std::make_unique<Chapter>(database(), std::move(row).value());
         else
             return std::nullopt;
     });
 }
 
+DBResult<std::optional<Chapter::Row>> Chapter::findNextRow(Database &db, long book, long chap) {
+    using namespace Util::ORM;
+    std::optional<Row> r;
+    return db.forEachRow<Table>(table.sqlSelect(book_id == book && chapter > chap, Sel::OrderBy(chapter), Sel::Limit(1)),
+                                [&r] (Row &&row) {
+        r = std::move(row);
+        return false;
+    }).map([&r] () {
+        return std::move(r);
+    });
+}
+
 QVariant Chapter::getNextChapterV() {
-    auto r = getNextChapter();
-    if (!r)
-        return QVariant();
-    auto opt = std::move(r.value());
-    if (!opt)
-        return QVariant();
-    return QVariant::fromValue(opt.value().release());
+    followChanges();
+    return m_next_chapter.get(this, [this] () {
+        return getNextChapter().map([] (std::optional<std::unique_ptr<Chapter>> &&opt) {
+            return opt ? QVariant::fromValue(opt.value().release()) : QVariant();
+        });
+    });
 }
 
 DBResult<std::optional<std::unique_ptr<Chapter>>> Chapter::getPreviousChapter() {
-    using namespace Util::ORM;
-    return database().select<Chapter>(book_id == get(book_id) && chapter < get(chapter), Sel::OrderBy(Chapter::chapter, true), Sel::Limit(1))
-            .map([] (std::vector<std::unique_ptr<Chapter>> &&cs) -> std::optional<std::unique_ptr<Chapter>> {
-        if (cs.size() > 0)
-            return std::move(cs[0]);
+    return findPreviousRow(database(), get(book_id), get(chapter))
+            .map([this] (std::optional<Row> &&row) -> std::optional<std::unique_ptr<Chapter>> {
+        if (row)
+            return std::make_unique<Chapter>(database(), std::move(row).value());
         else
             return std::nullopt;
     });
 }
 
+DBResult<std::optional<Chapter::Row>> Chapter::findPreviousRow(Database &db, long book, long chap) {
+    using namespace Util::ORM;
+    std::optional<Row> r;
+    return db.forEachRow<Table>(table.sqlSelect(book_id == book && chapter < chap, Sel::OrderBy(chapter, Sel::Descending), Sel::Limit(1)),
+                                [&r] (Row &&row) {
+        r = std::move(row);
+        return false;
+    }).map([&r] () {
+        return std::move(r);
+    });
+}
+
 QVariant Chapter::getPreviousChapterV() {
-    auto r = getPreviousChapter();
-    if (!r)
-        return QVariant();
-    auto opt = std::move(r.value());
-    if (!opt)
-        return QVariant();
-    return QVariant::fromValue(opt.value().release());
+    followChanges();
+    return m_previous_chapter.get(this, [this] () {
+        return getPreviousChapter().map([] (std::optional<std::unique_ptr<Chapter>> &&opt) {
+            return opt ? QVariant::fromValue(opt.value().release()) : QVariant();
+        });
+    });
 }
 
 DBResult<long> Chapter::getTotalOffset() {
     using namespace Util::ORM;
-    return database().exec(Util::ORM::select(Sel::From(Chapter::table, Expr::sum(Chapter::length)),
-                                             Chapter::book_id == get(book_id) && Chapter::chapter < get(chapter)))
-            .bind([] (QSqlQuery &&q) -> DBResult<long> {
-        if (q.next())
-            return Ok(q.value(0).toInt());
+    return database().selectOne(Util::ORM::select(Sel::From(Chapter::table, Expr::sum(Chapter::length)),
+                                                  Chapter::book_id == get(book_id) && Chapter::chapter < get(chapter)))
+            .bind([] (std::optional<std::tuple<long>> &&r) -> DBResult<long> {
+        if (r)
+            return Ok(std::get<0>(r.value()));
         else
             return Err(QSqlError("Sum didn't return anything"));
     });
@@ -84,4 +117,25 @@ QVariant Chapter::getTotalOffsetV() {
     return getTotalOffset().map([] (long x) {return QVariant::fromValue(x);}).value_or(QVariant());
 }
 
+// ---------------
+void Chapter::followChanges() {
+    if (following_changes)
+        return;
+    following_changes = true;
+    connect(&database().changes(), &ChangeFeed::rowsChanged, this, &Chapter::onRowsChanged);
+}
+
+void Chapter::onRowsChanged(const QVector<RowChange> &changes) {
+    bool chapters = std::any_of(changes.begin(), changes.end(), [] (const RowChange &c) {
+        return c.is(Chapter::table);
+    });
+    if (!chapters)
+        return;
+
+    bool had_any = m_next_chapter.reset();
+    had_any = m_previous_chapter.reset() || had_any;
+    if (had_any)
+        emit neighboursChanged();
+}
+
 }
@@ -11,8 +11,17 @@ class Chapter : public Object<Chapter>
     Q_OBJECT
 
     Q_PROPERTY(QVariant book READ getBookV)
-    Q_PROPERTY(QVariant nextChapter READ getNextChapterV)
-    Q_PROPERTY(QVariant previousChapter READ getPreviousChapterV)
+    Q_PROPERTY(QVariant nextChapter READ getNextChapterV NOTIFY neighboursChanged)
+    Q_PROPERTY(QVariant previousChapter READ getPreviousChapterV NOTIFY neighboursChanged)
+
+    // Property values for QML, reset by writes to Chapter reported on the change feed
+    Memo m_next_chapter;
+    Memo m_previous_chapter;
+    bool following_changes = false;
+
+    void followChanges();
+    void onRowsChanged(const QVector<RowChange> &changes);
+
 public:
     ORM_COLUMN(long, book_id, Util::ORM::NotNull);
     ORM_COLUMN(long, chapter, Util::ORM::NotNull);
@@ -26,14 +35,19 @@ public:
     DB_OBJECT(Chapter, "Chapter", book_id, chapter, length, media, media_offset, media_chapter, title, cover_blob_id,
               Util::ORM::ForeignKey(book_id, Util::ORM::References(Book::table, Book::id)),
               Util::ORM::ForeignKey(cover_blob_id, Util::ORM::References(Blob::table, Blob::id)),
-              Util::ORM::Unique(book_id, chapter));
+              Util::ORM::Unique(book_id, chapter),
+              Util::ORM::Index(media));
+
+    // BookStats rows written along with this one, see Object::recordTriggered()
+    static void recordTriggered(ChangeFeed &feed, const RowChange &change, const Row &row);
 
 
     explicit Chapter(Database &db, const Book &b, long chap, long length,
                      QString media, long media_offset, std::optional<long> media_chapter,
                      QString title=QString(), Blob *cover = nullptr);
 
-    explicit Chapter(Database &db, const QSqlRecord &r);
+    explicit Chapter(Database &db, Row &&data);
+    explicit Chapter(Database &db, const QSqlQuery &q);
 
 
     DBResult<std::unique_ptr<Book>> getBook();
@@ -42,12 +56,20 @@ public:
     DBResult<std::optional<std::unique_ptr<Chapter>>> getNextChapter();
     Q_INVOKABLE QVariant getNextChapterV();
 
+    /**
+     * @brief Row of the chapter following chapter in book, for use on a DatabaseWorker
+     */
+    static DBResult<std::optional<Row>> findNextRow(Database &db, long book, long chapter);
+    static DBResult<std::optional<Row>> findPreviousRow(Database &db, long book, long chapter);
+
     DBResult<std::optional<std::unique_ptr<Chapter>>> getPreviousChapter();
     Q_INVOKABLE QVariant getPreviousChapterV();
 
     DBResult<long> getTotalOffset();
     Q_INVOKABLE QVariant getTotalOffsetV();
 
+signals:
+    void neighboursChanged();
 };
 
 DB_OBJECT_POST(Chapter);
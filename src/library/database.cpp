@@ -1,6 +1,7 @@
 #include "database.h"
 
 #include <QSqlDatabase>
+#include <QSqlDriver>
 #include <QSqlQuery>
 #include <QSqlError>
 
@@ -8,17 +9,23 @@
 
 namespace Midoku::Library {
 
-Database::Database(QString path) :
-    name(path)
+Database::Database(QString path, QString connection, OpenMode mode) :
+    path(path),
+    name(connection.isEmpty() ? path : connection),
+    mode(mode),
+    owner_thread(QThread::currentThread())
 {
-    QSqlDatabase db;
-
     // Open DB
     if (QSqlDatabase::contains(name)) {
         db = QSqlDatabase::database(name);
     } else {
         db = QSqlDatabase::addDatabase("QSQLITE", name);
         db.setDatabaseName(path);
+        // Other connections to the same file may be writing, e.g. a DatabaseWorker
+        if (mode == ReadOnly)
+            db.setConnectOptions(QStringLiteral("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000"));
+        else
+            db.setConnectOptions(QStringLiteral("QSQLITE_BUSY_TIMEOUT=5000"));
         db.open();
     }
 
@@ -29,33 +36,358 @@ Database::Database(QString path) :
     // setup stuff
     QSqlQuery q = QSqlQuery(db);
     q.exec("PRAGMA FOREIGN_KEYS = ON;");
+    if (mode == ReadWrite) {
+        // Persistent, lets readers run alongside a write transaction.
+        // NORMAL only syncs at checkpoints, which is safe with WAL.
+        if (!q.exec("PRAGMA journal_mode = WAL;"))
+            qWarning() << "Could not enable WAL journaling:" << q.lastError().text();
+        q.exec("PRAGMA synchronous = NORMAL;");
+    }
+
+#ifdef MIDOKU_NATIVE_SQLITE
+    // Share the driver's connection so both sides see the same transactions
+    QVariant handle = db.driver()->handle();
+    if (!Sqlite::Connection::sharesLibrary(db.driver()))
+        qWarning() << "QSQLITE uses a different SQLite library";
+    else if (handle.isValid() && qstrcmp(handle.typeName(), "sqlite3*") == 0) {
+        if (auto h = *static_cast<sqlite3 **>(handle.data()))
+            native = std::make_unique<Sqlite::Connection>(h);
+    }
+
+    if (!native)
+        qWarning() << "Native SQLite access unavailable, falling back to QtSql";
+#endif
+
+    if (qEnvironmentVariableIsSet("MIDOKU_SQL_PROFILE"))
+        setProfilingEnabled(true);
 }
 
 Database::~Database()
 {
+    if (profiler.isEnabled() && qEnvironmentVariableIsSet("MIDOKU_SQL_PROFILE"))
+        qDebug().noquote() << "SQL profile:\n" + profiler.report();
+
+    {
+        QMutexLocker lock(&readers_mutex);
+        while (!readers.empty()) {
+            auto thread = readers.begin()->first;
+            lock.unlock();
+            remove_reader(thread);
+            lock.relock();
+        }
+    }
+
+    clearStatementCache();
 }
 
 // ---------------
 QSqlDatabase Database::qsqldb() {
-    return QSqlDatabase::database(name);
+    return db;
+}
+
+Database &Database::reader()
+{
+    auto thread = QThread::currentThread();
+    if (mode == ReadOnly || thread == owner_thread)
+        return *this;
+
+    QMutexLocker lock(&readers_mutex);
+    auto &r = readers[thread];
+    if (!r) {
+        auto connection = QStringLiteral("reader%1:%2").arg(reader_serial++).arg(path);
+        r = std::make_unique<Database>(path, connection, ReadOnly);
+        r->profiler.setEnabled(profiler.isEnabled());
+        // Nothing tells the reader about rows written elsewhere, cached rows would go stale
+        r->setRowCacheEnabled(false);
+        // finished is emitted from the thread itself, where the connection has to be closed
+        connect(thread, &QThread::finished, this, [this, thread] () {
+            remove_reader(thread);
+        }, Qt::DirectConnection);
+    }
+    return *r;
+}
+
+void Database::remove_reader(QThread *thread)
+{
+    std::unique_ptr<Database> r;
+    {
+        QMutexLocker lock(&readers_mutex);
+        auto it = readers.find(thread);
+        if (it == readers.end())
+            return;
+        r = std::move(it->second);
+        readers.erase(it);
+    }
+
+    disconnect(thread, &QThread::finished, this, nullptr);
+    auto connection = r->name;
+    r.reset();
+    QSqlDatabase::removeDatabase(connection);
 }
 
 // ---------------
 QSqlQuery Database::prepare(QString sql)
 {
-    //qDebug() << "SQL prepare:" << sql;
-    QSqlQuery q(QSqlDatabase::database(name));
-    q.prepare(sql);
-    return q;
+    return prepare_query(sql).query;
+}
+
+Database::PreparedQuery Database::prepare_query(const QString &sql)
+{
+    auto fresh = [this, &sql] () {
+        //qDebug() << "SQL prepare:" << sql;
+        QSqlQuery q(db);
+        // Results are only ever iterated once, don't let Qt cache the rows
+        q.setForwardOnly(true);
+        bool ok = q.prepare(sql);
+        return std::pair{q, ok};
+    };
+
+    auto it = statement_index.find(sql);
+    if (it != statement_index.end()) {
+        auto &cached = it.value()->second;
+        // Copies share the statement, and a Cursor may still be reading its rows
+        if (cached.query.isActive() && cached.query.isSelect())
+            return PreparedQuery{fresh().first, cached.placeholders};
+
+        // Move to front and reset whatever the previous user left behind
+        statements.splice(statements.begin(), statements, it.value());
+        cached.query.finish();
+        return cached;
+    }
+
+    auto [q, ok] = fresh();
+    PreparedQuery prepared{q, placeholder_names(sql)};
+    // Don't cache failed statements, the caller will get the error on exec()
+    if (!ok)
+        return prepared;
+
+    if (statements.size() >= statement_cache_size) {
+        statement_index.remove(statements.back().first);
+        statements.pop_back();
+    }
+
+    statements.emplace_front(sql, prepared);
+    statement_index.insert(sql, statements.begin());
+    return prepared;
+}
+
+void Database::clearStatementCache()
+{
+    // Schema changes invalidate cached rows as well
+    clearRowCache();
+    statement_index.clear();
+    statements.clear();
+#ifdef MIDOKU_NATIVE_SQLITE
+    if (native)
+        native->clearStatementCache();
+#endif
 }
 
+// ---------------
+void Database::setRowCacheEnabled(bool enabled)
+{
+    row_cache_enabled = enabled;
+    if (!enabled)
+        clearRowCache();
+}
+
+void Database::clearRowCache()
+{
+    row_caches.clear();
+}
+
+void Database::uncacheRows(const QVector<RowChange> &changes)
+{
+    for (const auto &c : changes)
+        for (auto &entry : row_caches)
+            if (entry.second->table == c.table)
+                entry.second->remove(c.id);
+}
+
+QStringList Database::placeholder_names(const QString &sql)
+{
+    // Distinct :name placeholders in order of first appearance
+    QStringList names;
+    QChar quote;
+    for (int i = 0; i < sql.size(); i++) {
+        QChar c = sql[i];
+        if (!quote.isNull()) {
+            if (c == quote)
+                quote = QChar();
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (c == ':' && i + 1 < sql.size() && (sql[i+1].isLetter() || sql[i+1] == '_')) {
+            int end = i + 1;
+            while (end < sql.size() && (sql[end].isLetterOrNumber() || sql[end] == '_'))
+                end++;
+
+            auto name = sql.mid(i, end - i);
+            if (!names.contains(name))
+                names.append(name);
+            i = end - 1;
+        }
+    }
+    return names;
+}
+
+// ---------------
+DBResult<Transaction> Database::begin()
+{
+    int depth = transaction_depth + 1;
+    if (depth == 1 && mode == ReadWrite) {
+        // Take the write lock up front. A deferred transaction that reads before
+        // writing fails with SQLITE_BUSY_SNAPSHOT if the worker committed in between,
+        // which the busy timeout doesn't retry.
+        auto r = exec(QStringLiteral("BEGIN IMMEDIATE;"));
+        if (!r)
+            return Err(std::move(r).error());
+    } else if (depth == 1) {
+        if (!db.transaction())
+            return Err(db.lastError());
+    } else {
+        auto r = exec(QStringLiteral("SAVEPOINT sp%0;").arg(depth));
+        if (!r)
+            return Err(std::move(r).error());
+    }
+
+    transaction_depth = depth;
+    change_feed.beginTransaction();
+    return Ok(Transaction(*this, depth));
+}
+
+// ---------------
+Transaction::Transaction(Database &db, int depth) :
+    db(&db), depth(depth)
+{}
+
+Transaction::Transaction(Transaction &&o) :
+    db(o.db), depth(o.depth)
+{
+    o.db = nullptr;
+}
+
+Transaction::~Transaction()
+{
+    if (db)
+        rollback();
+}
+
+DBResult<void> Transaction::finish(bool commit)
+{
+    if (!db)
+        return Err(QSqlError("Transaction already finished"));
+
+    assert(db->transaction_depth == depth && "Transactions must be finished in reverse order");
+
+    DBResult<void> r = Ok();
+    if (depth == 1) {
+        bool ok = commit ? db->db.commit() : db->db.rollback();
+        if (!ok)
+            r = Err(db->db.lastError());
+    } else {
+        if (commit)
+            r = db->exec(QStringLiteral("RELEASE sp%0;").arg(depth)).discard();
+        else
+            // ROLLBACK TO leaves the savepoint open
+            r = db->exec(QStringLiteral("ROLLBACK TO sp%0;").arg(depth)).bind([this] (QSqlQuery &&) {
+                return db->exec(QStringLiteral("RELEASE sp%0;").arg(depth)).discard();
+            });
+    }
+
+    // A failed COMMIT leaves the transaction open, let the destructor roll it back
+    if (!r && commit)
+        return r;
+
+    // The cache may hold rows written inside the rolled back transaction
+    if (!commit)
+        db->clearRowCache();
+
+    db->transaction_depth = depth - 1;
+    // Publishes after the outermost COMMIT, listeners may start a new transaction
+    std::exchange(db, nullptr)->change_feed.endTransaction(commit);
+    return r;
+}
+
+DBResult<void> Transaction::commit()
+{
+    return finish(true);
+}
+
+DBResult<void> Transaction::rollback()
+{
+    return finish(false);
+}
+
+// ---------------
 DBResult<void> Database::exec(QSqlQuery &q)
 {
-    qDebug() << "SQL:" << q.executedQuery() << q.boundValues();
-    if (!q.exec())
+    auto sample = begin_sample(q.lastQuery());
+    auto r = exec_timed(q, sample);
+    if (sample)
+        record_sample(*sample);
+    return r;
+}
+
+DBResult<void> Database::exec_timed(QSqlQuery &q, std::optional<QueryProfiler::Sample> &sample)
+{
+    if (sample)
+        sample->start();
+    bool ok = q.exec();
+    if (sample)
+        sample->stop();
+
+    if (!ok)
         return Err(q.lastError());
     else
         return Ok();
 }
 
+DBResult<void> Database::execute_query(QSqlQuery &q)
+{
+    return exec(q).map([this, &q] () {
+        last_insert_id = q.lastInsertId().toLongLong();
+        rows_affected = q.numRowsAffected();
+    });
+}
+
+#ifdef MIDOKU_NATIVE_SQLITE
+DBResult<void> Database::execute_native(Sqlite::Statement &s, const QString &sql)
+{
+    auto sample = begin_sample(sql);
+    if (sample)
+        sample->start();
+    auto r = s.exec();
+    if (sample) {
+        sample->stop();
+        record_sample(*sample);
+    }
+
+    return r.map([this] () {
+        last_insert_id = native->lastInsertId();
+        rows_affected = native->changes();
+    });
+}
+#endif
+
+// ---------------
+void Database::setProfilingEnabled(bool enabled)
+{
+    profiler.setEnabled(enabled);
+}
+
+void Database::record_sample(const QueryProfiler::Sample &s)
+{
+    if (!profiler.record(s))
+        return;
+
+    // Plain QSqlQuery, so the EXPLAIN isn't cached or profiled itself.
+    // Unbound placeholders are NULL, which doesn't change the plan's shape.
+    QSqlQuery q(db);
+    QStringList plan;
+    if (q.exec(QStringLiteral("EXPLAIN QUERY PLAN ") + s.query()))
+        while (q.next())
+            plan.append(q.value(3).toString());
+    profiler.setPlan(s.query(), plan);
+}
+
 } // namespace Midoku::Library
@@ -3,18 +3,34 @@
 #include "../util/result.h"
 #include "../util/tuple_util.h"
 #include "../util/orm.h"
+#include "changefeed.h"
+#include "profiler.h"
 
+#include <algorithm>
+#include <iterator>
+#include <list>
 #include <memory>
+#include <optional>
+#include <typeindex>
+#include <unordered_map>
 
 #include <QString>
+#include <QHash>
+#include <QCache>
+#include <QMutex>
 #include <QObject>
+#include <QThread>
 #include <QVariant>
 #include <QDebug>
 
+#include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QSqlError>
 #include <QSqlRecord>
 
+#ifdef MIDOKU_NATIVE_SQLITE
+#include "sqlite.h"
+#endif
 
 namespace Midoku::Library {
 
@@ -25,33 +41,272 @@ using DBResult = Util::Result<T, QSqlError>;
 using Util::Ok;
 using Util::Err;
 
+class Transaction;
+class DatabaseWorker;
+
+template <typename Table>
+class Cursor;
+
+
+namespace detail {
+template <typename T>
+QVariant qvariant_from_optional(const std::optional<T> &v) {
+    if (v)
+        return QVariant::fromValue(v.value());
+    else
+        return QVariant();
+}
+
+template <typename T>
+std::optional<T> optional_from_qvariant(const QVariant &v) {
+    if (v.isNull())
+        return std::nullopt;
+    else
+        return v.value<T>();
+}
+
+template <typename T>
+struct from_qvariant {
+    static T get(const QVariant &v) {
+        return v.value<T>();
+    }
+};
+
+template <typename T>
+struct from_qvariant<std::optional<T>> {
+    static std::optional<T> get(const QVariant &v) {
+        return optional_from_qvariant<T>(v);
+    }
+};
+
+template <typename T>
+QVariant to_qvariant(const T &v) {
+    return QVariant::fromValue(v);
+}
+
+template <typename T>
+QVariant to_qvariant(const std::optional<T> &v) {
+    return qvariant_from_optional(v);
+}
+
+// Approximate memory used by a row, for the row cache
+template <typename T>
+int value_cost(const T &) {
+    return sizeof(T);
+}
+
+inline int value_cost(const QString &v) {
+    return sizeof(QString) + v.size() * sizeof(QChar);
+}
+
+inline int value_cost(const QByteArray &v) {
+    return sizeof(QByteArray) + v.size();
+}
+
+template <typename T>
+int value_cost(const std::optional<T> &v) {
+    return v ? value_cost(v.value()) : sizeof(v);
+}
+
+// Key stored in a column, nullopt for NULL
+template <typename Col>
+std::optional<typename Col::value_type> key_value(const typename Col::type &v) {
+    if constexpr (Col::is_nullable) {
+        if (Col::nullable_type::is_unit(v))
+            return std::nullopt;
+        return Col::nullable_type::get(v);
+    } else {
+        return v;
+    }
+}
+
+// Element of a range of T, T* or std::unique_ptr<T>
+template <typename T, typename P>
+auto &object_ref(P &o) {
+    if constexpr (std::is_same_v<std::remove_const_t<P>, T>)
+        return o;
+    else
+        return *o;
+}
+
+// Values bound to a single IN query, well below SQLITE_MAX_VARIABLE_NUMBER
+static constexpr size_t in_batch_size = 500;
+
+struct row_cache_base {
+    QString table;
+
+    explicit row_cache_base(QString table) :
+        table(std::move(table))
+    {}
+
+    virtual ~row_cache_base() = default;
+    virtual void remove(long id) = 0;
+};
+
+template <typename Row>
+struct row_cache : row_cache_base {
+    QCache<long, Row> rows;
+
+    row_cache(QString table, int max_cost) :
+        row_cache_base(std::move(table)),
+        rows(max_cost)
+    {}
+
+    virtual void remove(long id) override {
+        rows.remove(id);
+    }
+};
+}
+
+
+/**
+ * @brief Relations to load along with the selected objects
+ * @see Object::select(Database &, Include<Related...>, Opts...)
+ */
+template <typename... Related>
+struct Include {};
+
+template <typename... Related>
+inline constexpr Include<Related...> include = {};
+
 
 /**
  * @brief The Database class
  */
 class Database : public QObject
 {
+public:
+    enum OpenMode {
+        ReadWrite,
+        ReadOnly,
+    };
+
+private:
+    QString path;
     QString name;
+    QSqlDatabase db;
+    OpenMode mode;
+
+    // Read-only connections for other threads, see reader()
+    QThread *owner_thread;
+    QMutex readers_mutex;
+    std::unordered_map<QThread*, std::unique_ptr<Database>> readers;
+    int reader_serial = 0;
+
+    void remove_reader(QThread *thread);
+
+    // A statement with its :name placeholders, see placeholder_names()
+    struct PreparedQuery {
+        QSqlQuery query;
+        QStringList placeholders;
+    };
+
+    // LRU cache of prepared statements, most recently used first
+    // Must be destroyed before the connection
+    using StatementCache = std::list<std::pair<QString, PreparedQuery>>;
+    static constexpr size_t statement_cache_size = 64;
+    StatementCache statements;
+    QHash<QString, StatementCache::iterator> statement_index;
+
+#ifdef MIDOKU_NATIVE_SQLITE
+    // Direct access to the QSQLITE driver's connection, if Qt uses the same SQLite library
+    std::unique_ptr<Sqlite::Connection> native;
+#endif
+    long last_insert_id = -1;
+    long rows_affected = 0;
+
+    // Identity map of rows loaded by id, one cache per table
+    static constexpr int row_cache_cost = 1 << 20;
+    std::unordered_map<std::type_index, std::unique_ptr<detail::row_cache_base>> row_caches;
+    bool row_cache_enabled = true;
+
+    template <typename Table>
+    auto *row_cache();
+
+    // Number of open Transaction guards
+    int transaction_depth = 0;
+    friend class Transaction;
+
+    ChangeFeed change_feed;
+
+    // Statement timing, nullopt samples when disabled
+    QueryProfiler profiler;
+
+    template <typename Table>
+    friend class Cursor;
+
+    std::optional<QueryProfiler::Sample> begin_sample(const QString &sql) {
+        if (!profiler.isEnabled())
+            return std::nullopt;
+        return QueryProfiler::Sample(sql);
+    }
+
+    void record_sample(const QueryProfiler::Sample &s);
+    DBResult<void> exec_timed(QSqlQuery &q, std::optional<QueryProfiler::Sample> &sample);
+
+    // Finish execute()
+    DBResult<void> execute_query(QSqlQuery &q);
+#ifdef MIDOKU_NATIVE_SQLITE
+    DBResult<void> execute_native(Sqlite::Statement &s, const QString &sql);
+#endif
 
     DBResult<void> remove_key(const QString &tbl, long key);
     DBResult<bool> contains_key(const QString &tbl, long key);
 
+    static QStringList placeholder_names(const QString &sql);
+    PreparedQuery prepare_query(const QString &sql);
+
 public:
-    Database(QString path);
+    /**
+     * @param connection    QtSql connection name, defaults to the path.
+     *                      Each thread needs its own connection.
+     * @param mode          ReadWrite connections switch the database to WAL journaling
+     */
+    Database(QString path, QString connection = QString(), OpenMode mode = ReadWrite);
     virtual ~Database();
 
     QSqlDatabase qsqldb();
 
+    bool isReadOnly() const {
+        return mode == ReadOnly;
+    }
+
+    /**
+     * @brief A read-only connection for the calling thread
+     * Connections are opened on first use and closed when their QThread finishes.
+     * With WAL journaling they read concurrently with the writer, seeing the last
+     * committed state. On the thread that created this Database, returns *this so that
+     * reads see its open transaction. Readers don't cache rows.
+     * Threads still holding a reader must finish before this Database is destroyed.
+     */
+    Database &reader();
+
     // SQL Queries
+    /**
+     * @brief Get a prepared statement for sql
+     * Statements are cached by their SQL text and shared with previous callers,
+     * unless a previous caller's result set is still active.
+     */
     QSqlQuery prepare(QString sql);
+    void clearStatementCache();
     DBResult<void> exec(QSqlQuery &);
 
     // Handle bound SQL queries
+    /**
+     * Binds are positional. With named placeholders they are matched in order of
+     * first appearance, which is how SQLite numbers them.
+     * std::vector binds fill one placeholder per element.
+     */
     template <typename... Ts>
-    QSqlQuery prepare(Util::ORM::SQL<Ts...> sql) {
-        auto q = prepare(sql.query);
-        Util::tuple_enumerate_foreach(sql.binds, [&q](size_t i, auto x) {
-            q.bindValue(i, QVariant::fromValue(x));
+    QSqlQuery prepare(const Util::ORM::SQL<Ts...> &sql) {
+        auto [q, names] = prepare_query(sql.query);
+        int i = 0;
+        Util::ORM::sql_foreach_bind_value(sql.binds, [&q, &names, &i](const auto &x) {
+            if (names.isEmpty())
+                q.bindValue(i, detail::to_qvariant(x));
+            else
+                q.bindValue(names[i], detail::to_qvariant(x));
+            i++;
         });
         return q;
     }
@@ -76,6 +331,141 @@ public:
         return exec(q.sqlQuery());
     }
 
+    /**
+     * @brief Describe how SQLite would run a query, one line per EXPLAIN QUERY PLAN step
+     * e.g. "SEARCH Chapter USING INDEX Chapter_media (media=?)" or "SCAN Chapter"
+     */
+    template <typename... Ts>
+    DBResult<QStringList> queryPlan(const Util::ORM::SQL<Ts...> &sql) {
+        return exec(Util::ORM::SQL{QStringLiteral("EXPLAIN QUERY PLAN ") + sql.query, sql.binds}).map([] (QSqlQuery &&q) {
+            QStringList plan;
+            while (q.next())
+                plan.append(q.value(3).toString());
+            return plan;
+        });
+    }
+
+    template <Util::ORM::SQLQuery Q>
+    DBResult<QStringList> queryPlan(const Q &q) {
+        return queryPlan(q.sqlQuery());
+    }
+
+    // ORM statements
+    // These bypass QtSql when built with MIDOKU_NATIVE_SQLITE
+    /**
+     * @brief Run a statement that doesn't return rows
+     */
+    template <typename... Ts>
+    DBResult<void> execute(const Util::ORM::SQL<Ts...> &sql);
+
+    /**
+     * @brief Run a statement binding only some of the values in sql.binds
+     * Bit i of mask selects sql.binds[i], selected values fill the placeholders in order.
+     */
+    template <typename... Ts>
+    DBResult<void> execute(const Util::ORM::SQL<Ts...> &sql, quint64 mask);
+
+    /**
+     * @return The row ID of the last row inserted by execute()
+     */
+    long lastInsertId() const {
+        return last_insert_id;
+    }
+
+    /**
+     * @return The number of rows changed by the last execute()
+     */
+    long rowsAffected() const {
+        return rows_affected;
+    }
+
+    /**
+     * @brief Lazily iterate the rows of a query selecting all columns of Table
+     */
+    template <typename Table, typename... Ts>
+    DBResult<Cursor<Table>> rows(const Util::ORM::SQL<Ts...> &sql);
+
+    // Projections
+    // Rows are tuples of the selected expressions' types, e.g. for
+    // select(Sel::Columns(Chapter::table, Chapter::id, Chapter::length), ...)
+    template <Util::ORM::Sel::Projection From, typename... Cs>
+    DBResult<Cursor<typename From::Row>> rows(const Util::ORM::Sel::Select<From, Cs...> &q) {
+        return rows<typename From::Row>(q.sqlQuery());
+    }
+
+    template <Util::ORM::Sel::Projection From, typename... Cs>
+    DBResult<std::vector<typename From::Row>> select(const Util::ORM::Sel::Select<From, Cs...> &q);
+
+    template <Util::ORM::Sel::Projection From, typename... Cs>
+    DBResult<std::optional<typename From::Row>> selectOne(const Util::ORM::Sel::Select<From, Cs...> &q);
+
+    /**
+     * @brief Call f with each row of a query selecting all columns of Table
+     * Rows are passed as Table::ColumnTypes::tuple. f may return false to stop early.
+     * f must not run the same SQL text again while iterating.
+     */
+    template <typename Table, typename F, typename... Ts>
+    DBResult<void> forEachRow(const Util::ORM::SQL<Ts...> &sql, F &&f);
+
+    // Row cache
+    /**
+     * @brief Cache rows loaded through Object::load()
+     * Rows are invalidated by Object::save() and dropped on rollback. Writes that
+     * bypass the ORM must call clearRowCache().
+     */
+    void setRowCacheEnabled(bool enabled);
+    void clearRowCache();
+
+    template <typename Table>
+    std::optional<typename Table::ColumnTypes::tuple> cachedRow(long id);
+
+    template <typename Table>
+    void cacheRow(long id, const typename Table::ColumnTypes::tuple &row);
+
+    template <typename Table>
+    void uncacheRow(long id);
+
+    /**
+     * @brief Drop cached rows written through another connection
+     * e.g. connected to a DatabaseWorker's change feed
+     */
+    void uncacheRows(const QVector<RowChange> &changes);
+
+    // Change feed
+    /**
+     * @brief Rows written through this connection, published after they are committed
+     * Feeds of other connections may be forwarded into it, e.g. a DatabaseWorker's.
+     */
+    ChangeFeed &changes() {
+        return change_feed;
+    }
+
+    // Profiling
+    /**
+     * @brief Time every statement, see QueryProfiler
+     * Also enabled by setting MIDOKU_SQL_PROFILE, which prints a report on exit.
+     */
+    void setProfilingEnabled(bool enabled);
+
+    QueryProfiler &queryProfiler() {
+        return profiler;
+    }
+
+    // Transactions
+    /**
+     * @brief Open a transaction, or a savepoint if one is already open
+     * Transactions on ReadWrite connections take the write lock right away (BEGIN IMMEDIATE).
+     */
+    DBResult<Transaction> begin();
+
+    /**
+     * @brief Run f inside a transaction
+     * Commits if f returns Ok and rolls back if it returns Err.
+     * @return f's result, or the error from BEGIN or COMMIT
+     */
+    template <typename F>
+    auto transaction(F &&f) -> std::invoke_result_t<F>;
+
     // Existence
     template<typename T>
     inline DBResult<bool> exists(long id) {
@@ -112,39 +502,465 @@ public:
 };
 
 
+/**
+ * @brief Scoped transaction
+ * The outermost transaction uses BEGIN/COMMIT, nested ones use savepoints.
+ * Rolls back on destruction unless committed. Guards must be closed in reverse order.
+ */
+class Transaction
+{
+    Database *db;
+    int depth;
+
+    Transaction(Database &db, int depth);
+    friend class Database;
+
+    DBResult<void> finish(bool commit);
+
+public:
+    Transaction(Transaction &&o);
+    Transaction(const Transaction &) = delete;
+    ~Transaction();
+
+    bool isOpen() const {
+        return db != nullptr;
+    }
+
+    DBResult<void> commit();
+    DBResult<void> rollback();
+};
+
+template <typename F>
+auto Database::transaction(F &&f) -> std::invoke_result_t<F> {
+    using R = std::invoke_result_t<F>;
+    return begin().bind([&f] (Transaction &&t) -> R {
+        R r = std::invoke(std::forward<F>(f));
+        if (!r) {
+            t.rollback();
+            return r;
+        }
+        return t.commit().bind([&r] () -> R {
+            return std::move(r);
+        });
+    });
+}
+
+
 namespace detail {
-M_TEMPLATE_FUNCTOR(auto, unpack_functor, Col, (const QSqlRecord &r), {
-    const QVariant &v = r.value(Col::name.value);
+template <typename Col>
+inline typename Col::type unpack_value(const QVariant &v) {
     //qDebug() << "Unpack" << typeid(typename Col::type).name() << Col::name.value << v;
     if constexpr (Col::is_nullable)
         return v.isNull()? Col::nullable_type::unit() : Col::nullable_type::value(v.template value<typename Col::value_type>());
     else
         return v.template value<typename Col::type>();
+}
+
+M_TEMPLATE_FUNCTOR(auto, unpack_functor, Col, (const QSqlRecord &r), {
+    return unpack_value<Col>(r.value(Col::name.value));
 });
 
-template <typename T>
-QVariant qvariant_from_optional(const std::optional<T> &v) {
-    if (v)
-        return QVariant::fromValue(v.value());
-    else
-        return QVariant();
+template <typename Table, size_t... I>
+inline auto unpack_query(const QSqlQuery &q, std::index_sequence<I...>) {
+    return typename Table::ColumnTypes::tuple {
+        unpack_value<typename Table::Columns::template get<I>>(q.value(I))...
+    };
 }
 
-template <typename T>
-std::optional<T> optional_from_qvariant(const QVariant &v) {
-    if (v.isNull())
-        return std::nullopt;
-    else
-        return v.value<T>();
-}
 }
 
 
+namespace detail {
+template <typename Tuple, size_t... I>
+inline Tuple unpack_tuple(const QSqlQuery &q, std::index_sequence<I...>) {
+    return Tuple {
+        from_qvariant<std::tuple_element_t<I, Tuple>>::get(q.value(I))...
+    };
+}
+}
+
 template <typename Table>
 static inline auto qsql_unpack_record(const QSqlRecord &r) {
     return Table::Columns::template tuple_map<detail::unpack_functor>(r);
 }
 
+/**
+ * @brief Unpack the current row of a query by column index
+ * The query must select all columns of Table in declaration order, like Table::sqlSelect() does.
+ */
+template <typename Table>
+static inline auto qsql_unpack_query(const QSqlQuery &q) {
+    return detail::unpack_query<Table>(q, typename Table::Columns::index_sequence());
+}
+
+/**
+ * @brief Unpack the current row of a query into a tuple, one column per element
+ */
+template <typename Tuple>
+static inline Tuple qsql_unpack_tuple(const QSqlQuery &q) {
+    return detail::unpack_tuple<Tuple>(q, std::make_index_sequence<std::tuple_size_v<Tuple>>());
+}
+
+
+namespace detail {
+// How a Cursor decodes rows
+template <typename Table>
+struct cursor_row {
+    using type = Util::ORM::RowStorage<Table>;
+
+    static type get(const QSqlQuery &q) {
+        return type(qsql_unpack_query<Table>(q));
+    }
+
+#ifdef MIDOKU_NATIVE_SQLITE
+    static type get(const Sqlite::Statement &s) {
+        return type(s.template row<typename Table::ColumnTypes::tuple>());
+    }
+#endif
+};
+
+// Projections
+template <typename... Ts>
+struct cursor_row<std::tuple<Ts...>> {
+    using type = std::tuple<Ts...>;
+
+    static type get(const QSqlQuery &q) {
+        return qsql_unpack_tuple<type>(q);
+    }
+
+#ifdef MIDOKU_NATIVE_SQLITE
+    static type get(const Sqlite::Statement &s) {
+        return s.template row<type>();
+    }
+#endif
+};
+}
+
+
+/**
+ * @brief Forward cursor over the rows of a query
+ * Rows are decoded one at a time, so scans run in constant memory. For a Table they are
+ * decoded into a RowStorage, for a std::tuple of column types into that tuple.
+ * The statement is the cursor's own until it is closed. Running the same SQL text
+ * meanwhile, e.g. nested in a loop over the rows, prepares a separate statement.
+ */
+template <typename Table>
+class Cursor
+{
+public:
+    using Row = typename detail::cursor_row<Table>::type;
+
+private:
+    bool active = true;
+#ifdef MIDOKU_NATIVE_SQLITE
+    std::optional<Sqlite::Statement> stmt;
+#endif
+    std::optional<QSqlQuery> query;
+    std::optional<Row> current;
+    std::optional<QSqlError> error;
+
+    // Fetching counts towards the statement's time in the profiler
+    Database *db;
+    std::optional<QueryProfiler::Sample> sample;
+
+    friend class Database;
+
+#ifdef MIDOKU_NATIVE_SQLITE
+    Cursor(Sqlite::Statement s, Database *db, std::optional<QueryProfiler::Sample> &&sample) :
+        stmt(std::move(s)), db(db), sample(std::move(sample))
+    {}
+#endif
+
+    Cursor(QSqlQuery q, Database *db, std::optional<QueryProfiler::Sample> &&sample) :
+        query(std::move(q)), db(db), sample(std::move(sample))
+    {}
+
+    void advance() {
+        auto r = next();
+        if (!r)
+            error = std::move(r).error();
+    }
+
+public:
+    Cursor(Cursor &&o) :
+        active(o.active),
+#ifdef MIDOKU_NATIVE_SQLITE
+        stmt(std::move(o.stmt)),
+#endif
+        query(o.query),
+        current(std::move(o.current)),
+        error(std::move(o.error)),
+        db(o.db),
+        sample(std::move(o.sample))
+    {
+        o.active = false;
+#ifdef MIDOKU_NATIVE_SQLITE
+        o.stmt.reset();
+#endif
+        o.sample.reset();
+    }
+
+    Cursor(const Cursor &) = delete;
+
+    ~Cursor() {
+        close();
+    }
+
+    /**
+     * @brief Step to the next row
+     * @return false once all rows have been read
+     */
+    DBResult<bool> next() {
+        current.reset();
+        if (!active)
+            return Ok(false);
+
+        if (sample)
+            sample->start();
+
+#ifdef MIDOKU_NATIVE_SQLITE
+        if (stmt) {
+            auto more = stmt->step();
+            if (more && more.value()) {
+                current.emplace(detail::cursor_row<Table>::get(*stmt));
+                if (sample)
+                    sample->addRow();
+            }
+            if (sample)
+                sample->stop();
+            if (!more || !more.value())
+                close();
+            return more;
+        }
+#endif
+
+        bool more = query->next();
+        if (sample)
+            sample->stop();
+
+        if (more) {
+            current.emplace(detail::cursor_row<Table>::get(*query));
+            if (sample)
+                sample->addRow();
+            return Ok(true);
+        }
+
+        auto err = query->lastError();
+        close();
+        if (err.isValid())
+            return Err(std::move(err));
+        return Ok(false);
+    }
+
+    /**
+     * @brief The current row, only valid after next() returned true
+     */
+    Row &row() {
+        return *current;
+    }
+
+    /**
+     * @brief Release the statement before reaching the end
+     */
+    void close() {
+        if (!active)
+            return;
+        active = false;
+#ifdef MIDOKU_NATIVE_SQLITE
+        // Back to the cache
+        if (stmt) {
+            stmt->reset();
+            stmt.reset();
+        }
+#endif
+        if (query)
+            query->finish();
+        if (sample) {
+            db->record_sample(*sample);
+            sample.reset();
+        }
+    }
+
+    /**
+     * @return The error that ended iteration, if any
+     */
+    DBResult<void> status() const {
+        if (error)
+            return Err(QSqlError(error.value()));
+        return Ok();
+    }
+
+    // Range interface, begin() steps to the first row
+    class iterator
+    {
+        Cursor *c;
+
+    public:
+        using value_type = Row;
+        using difference_type = std::ptrdiff_t;
+
+        explicit iterator(Cursor *c) :
+            c(c)
+        {}
+
+        Row &operator*() const {
+            return *c->current;
+        }
+
+        iterator &operator++() {
+            c->advance();
+            return *this;
+        }
+
+        void operator++(int) {
+            ++*this;
+        }
+
+        bool operator==(std::default_sentinel_t) const {
+            return !c->current;
+        }
+    };
+
+    iterator begin() {
+        advance();
+        return iterator(this);
+    }
+
+    std::default_sentinel_t end() {
+        return {};
+    }
+};
+
+template <typename Table>
+auto *Database::row_cache() {
+    using Cache = detail::row_cache<typename Table::ColumnTypes::tuple>;
+    auto &c = row_caches[std::type_index(typeid(Table))];
+    if (!c)
+        c = std::make_unique<Cache>(Table::getName(), row_cache_cost);
+    return static_cast<Cache *>(c.get());
+}
+
+template <typename Table>
+std::optional<typename Table::ColumnTypes::tuple> Database::cachedRow(long id) {
+    if (!row_cache_enabled)
+        return std::nullopt;
+    if (auto row = row_cache<Table>()->rows.object(id))
+        return *row;
+    return std::nullopt;
+}
+
+template <typename Table>
+void Database::cacheRow(long id, const typename Table::ColumnTypes::tuple &row) {
+    if (!row_cache_enabled)
+        return;
+    int cost = std::apply([] (const auto &... v) {return (detail::value_cost(v) + ...);}, row);
+    // Takes ownership, rows bigger than the whole cache are dropped right away
+    row_cache<Table>()->rows.insert(id, new typename Table::ColumnTypes::tuple(row), cost);
+}
+
+template <typename Table>
+void Database::uncacheRow(long id) {
+    auto it = row_caches.find(std::type_index(typeid(Table)));
+    if (it != row_caches.end())
+        static_cast<detail::row_cache<typename Table::ColumnTypes::tuple> *>(it->second.get())->rows.remove(id);
+}
+
+template <typename Table, typename... Ts>
+DBResult<Cursor<Table>> Database::rows(const Util::ORM::SQL<Ts...> &sql) {
+    auto sample = begin_sample(sql.query);
+
+#ifdef MIDOKU_NATIVE_SQLITE
+    if (native)
+        return native->prepare(sql).map([this, &sample] (Sqlite::Statement &&s) {
+            return Cursor<Table>(s, this, std::move(sample));
+        });
+#endif
+
+    // The cursor finishes the sample once all rows are read
+    auto q = prepare(sql);
+    return exec_timed(q, sample).map([this, &q, &sample] () {
+        return Cursor<Table>(std::move(q), this, std::move(sample));
+    });
+}
+
+template <Util::ORM::Sel::Projection From, typename... Cs>
+DBResult<std::vector<typename From::Row>> Database::select(const Util::ORM::Sel::Select<From, Cs...> &q) {
+    return rows(q).bind([] (Cursor<typename From::Row> &&c) -> DBResult<std::vector<typename From::Row>> {
+        std::vector<typename From::Row> r;
+        for (auto &row : c)
+            r.push_back(std::move(row));
+        return c.status().map([&r] () {
+            return std::move(r);
+        });
+    });
+}
+
+template <Util::ORM::Sel::Projection From, typename... Cs>
+DBResult<std::optional<typename From::Row>> Database::selectOne(const Util::ORM::Sel::Select<From, Cs...> &q) {
+    return rows(q).bind([] (Cursor<typename From::Row> &&c) {
+        return c.next().map([&c] (bool found) -> std::optional<typename From::Row> {
+            if (!found)
+                return std::nullopt;
+            return std::move(c.row());
+        });
+    });
+}
+
+template <typename... Ts>
+DBResult<void> Database::execute(const Util::ORM::SQL<Ts...> &sql) {
+#ifdef MIDOKU_NATIVE_SQLITE
+    if (native)
+        return native->prepare(sql).bind([this, &sql] (Sqlite::Statement &&s) {
+            return execute_native(s, sql.query);
+        });
+#endif
+
+    auto q = prepare(sql);
+    return execute_query(q);
+}
+
+template <typename... Ts>
+DBResult<void> Database::execute(const Util::ORM::SQL<Ts...> &sql, quint64 mask) {
+    static_assert(sizeof...(Ts) <= 64, "Too many binds for mask");
+
+#ifdef MIDOKU_NATIVE_SQLITE
+    if (native)
+        return native->prepare(sql.query).bind([this, &sql, mask] (Sqlite::Statement &&s) {
+            DBResult<void> r = Ok();
+            int pos = 1;
+            Util::tuple_enumerate_foreach(sql.binds, [&s, &r, &pos, mask] (size_t i, const auto &v) {
+                if (r && (mask >> i) & 1)
+                    r = s.bind(pos++, v);
+            });
+            return r.bind([this, &s, &sql] () {
+                return execute_native(s, sql.query);
+            });
+        });
+#endif
+
+    auto q = prepare(sql.query);
+    int pos = 0;
+    Util::tuple_enumerate_foreach(sql.binds, [&q, &pos, mask] (size_t i, const auto &v) {
+        if ((mask >> i) & 1)
+            q.bindValue(pos++, detail::to_qvariant(v));
+    });
+    return execute_query(q);
+}
+
+template <typename Table, typename F, typename... Ts>
+DBResult<void> Database::forEachRow(const Util::ORM::SQL<Ts...> &sql, F &&f) {
+    using Row = typename Table::ColumnTypes::tuple;
+    return rows<Table>(sql).bind([&f] (Cursor<Table> &&c) {
+        for (auto &row : c) {
+            if constexpr (std::is_void_v<std::invoke_result_t<F, Row&&>>)
+                std::invoke(f, std::move(row).take());
+            else if (!std::invoke(f, std::move(row).take()))
+                break;
+        }
+        return c.status();
+    });
+}
+
 #define DB_Q_OBJECT \
     static const QMetaObject staticMetaObject; \
     virtual const QMetaObject *metaObject() const; \
@@ -422,6 +1238,21 @@ protected:
         QMetaObject::activate(this, &staticMetaObject, Self::Table::template column_index<Col>(), _a);
     }
 
+    /**
+     * @brief Record the writes of SQL triggers on Self's table, which the change feed doesn't see
+     * Called for every insert and update of a row. Hidden in classes whose table has triggers.
+     */
+    template <typename Row>
+    static void recordTriggered(ChangeFeed &, const RowChange &, const Row &) {}
+
+    template <typename Row>
+    static void recordWrite(Database &db, const Row &row, long id, RowChange::Kind kind,
+                            quint64 columns = ~quint64(0) >> (64 - Self::Table::Columns::size)) {
+        RowChange change{Self::Table::getName(), id, kind, columns};
+        db.changes().record(change);
+        Self::recordTriggered(db.changes(), change, row);
+    }
+
     // ----------------------------------------------------
     // QObject implementation
 public:
@@ -517,11 +1348,15 @@ public:
         return &Object<Self>::template changed<std::decay_t<Col>>;
     }
 
+    static constexpr auto sqlInsertText() {
+        return Util::tstring_concat("INSERT INTO "_T, Self::Table::name, " ("_T, Self::Table::sqlColumnsText(), ") VALUES ("_T,
+                                    Util::ORM::detail::sql_text_join<typename Self::Table::Columns>(", "_T, [] (auto) {return "?"_T;}), ");"_T);
+    }
+
     static Util::ORM::SQL<long> sqlSelectId(long id) {
-        static QString query = QStringLiteral("SELECT %0 FROM %1 WHERE id = ?;")
-                .arg(Self::table.getColumnNames().join(", "))
-                .arg(Self::table.name.value);
-        return {query, {id}};
+        return Util::ORM::sql_static(Util::tstring_concat("SELECT "_T, Self::Table::sqlColumnsText(), " FROM "_T,
+                                                          Self::Table::name, " WHERE id = ?;"_T),
+                                     std::tuple{id});
     }
 
 public:
@@ -536,123 +1371,297 @@ public:
 
     // Load from DB
     static inline DBResult<std::unique_ptr<Self>> load(Database &db, long id) {
-        return db.exec(sqlSelectId(id)).map([&db](QSqlQuery &&q) {
-            q.next();
-            return std::make_unique<Self>(db, q.record());
+        if (auto row = db.cachedRow<typename Self::Table>(id))
+            return Ok(std::make_unique<Self>(db, std::move(row).value()));
+
+        std::unique_ptr<Self> o;
+        return db.forEachRow<typename Self::Table>(sqlSelectId(id), [&db, &o, id] (typename Self::Row &&row) {
+            db.cacheRow<typename Self::Table>(id, row);
+            o = std::make_unique<Self>(db, std::move(row));
+            return false;
+        }).bind([&o, id] () -> DBResult<std::unique_ptr<Self>> {
+            if (!o)
+                return Err(QSqlError(QStringLiteral("No row with id %0 in %1").arg(id).arg(QLatin1String(Self::Table::name.value))));
+            return Ok(std::move(o));
         });
     }
 
     static inline DBResult<std::vector<std::unique_ptr<Self>>> list(Database &db) {
-        return db.exec(Self::table.sqlSelectAll()).map([&db](QSqlQuery &&q) {
-            std::vector<std::unique_ptr<Self>> r;;
-            if (!q.next())
-                return r;
-            // don't use q.size() w/ sqlite!
-            //r.reserve(q.size());
-            do
-                r.emplace_back(std::make_unique<Self>(db, q.record()));
-            while (q.next());
-            return r;
-        });
+        return select(db, Self::table.sqlSelectAll());
     }
 
     template <typename Sel, typename... Opts>
     static inline DBResult<std::vector<std::unique_ptr<Self>>> select(Database &db, const Sel &sel, Opts... opts) {
-        return db.exec(Self::table.sqlSelect(sel, opts...)).map([&db](QSqlQuery q) {
-            std::vector<std::unique_ptr<Self>> r;;
-            if (!q.next())
-                return r;
-            // don't use q.size() w/ sqlite!
-            //r.reserve(q.size());
-            do
-                r.emplace_back(std::make_unique<Self>(db, q.record()));
-            while (q.next());
-            return r;
+        return select(db, Self::table.sqlSelect(sel, opts...));
+    }
+
+    template <typename... Ts>
+    static inline DBResult<std::vector<std::unique_ptr<Self>>> select(Database &db, const Util::ORM::SQL<Ts...> &sql) {
+        // don't use q.size() w/ sqlite!
+        std::vector<std::unique_ptr<Self>> r;
+        return db.forEachRow<typename Self::Table>(sql, [&db, &r] (typename Self::Row &&row) {
+            r.emplace_back(std::make_unique<Self>(db, std::move(row)));
+        }).map([&r] () {
+            return std::move(r);
         });
     }
 
+    /**
+     * @brief Lazily iterate matching rows without creating objects
+     * Use materialize() for the rows that need to become a QObject.
+     */
+    template <typename... Opts>
+    static inline auto cursor(Database &db, Opts... opts) {
+        return db.rows<typename Self::Table>(Self::table.sqlSelect(opts...));
+    }
+
+    template <typename Table>
+    static inline std::unique_ptr<Self> materialize(Database &db, Util::ORM::RowStorage<Table> &&row) {
+        return std::make_unique<Self>(db, std::move(row).take());
+    }
+
     template <typename... Opts>
     static inline DBResult<std::unique_ptr<Self>> selectOne(Database &db, Opts... opts) {
-        return db.exec(Self::table.sqlSelect(opts..., Util::ORM::Sel::Limit(1))).map([&db](QSqlQuery q) {
-            if (!q.next())
-                return std::unique_ptr<Self>{};
-            return std::make_unique<Self>(db, q.record());
+        std::unique_ptr<Self> o;
+        return db.forEachRow<typename Self::Table>(Self::table.sqlSelect(opts..., Util::ORM::Sel::Limit(1)),
+                                                  [&db, &o] (typename Self::Row &&row) {
+            o = std::make_unique<Self>(db, std::move(row));
+            return false;
+        }).map([&o] () {
+            return std::move(o);
         });
     }
 
-    // Save to DB
-    DBResult<long> save() {
-        static QStringList columns = Self::Table::getColumnNames();
-        static QStringList placeholders = [] {
-            QStringList r;
-            r.reserve(columns.size());
-            for (auto col : columns)
-                r.append(QStringLiteral(":%0").arg(col));
-            return r;
+    // Relations
+    /**
+     * @brief Select objects and load the related rows of all of them up front
+     * Runs one IN query per relation and keeps the rows in the row cache, so that
+     * following foreign keys with load(), e.g. Chapter::getBook(), doesn't query again.
+     * Usage: Chapter::select(db, include<Book, Blob>, Chapter::length > 0)
+     */
+    template <typename... Related, typename... Opts>
+    static DBResult<std::vector<std::unique_ptr<Self>>> select(Database &db, Include<Related...>, Opts... opts) {
+        DBResult<std::vector<std::unique_ptr<Self>>> r = [&db, &opts...] () {
+            if constexpr (sizeof...(Opts) == 0)
+                return list(db);
+            else
+                return select(db, opts...);
         }();
+        if (!r)
+            return r;
+
+        DBResult<void> loaded = Ok();
+        ((loaded = forEachRelatedRow<Related>(db, r.value(), [&db] (typename Related::Row &&row) {
+            cacheRelatedRow<Related>(db, row);
+        })) && ...);
+        if (!loaded)
+            return Err(std::move(loaded).error());
+        return r;
+    }
+
+    /**
+     * @brief Load the objects related to a range of objects through a foreign key
+     * @param objects   Range of Self, Self* or std::unique_ptr<Self>
+     * @param opts      Additional constraints, e.g. Sel::OrderBy
+     * If Self references Related (Chapter -> Book) the result maps each referenced key to its object.
+     * If Related references Self (Book -> Chapter) it maps each key of Self to the referencing objects.
+     * Keys are queried in batches with IN, never one row at a time.
+     */
+    template <typename Related, typename Range, typename... Opts>
+    static auto loadRelated(Database &db, const Range &objects, Opts... opts) {
+        using namespace Util::ORM;
+        if constexpr (has_foreign_key_to<typename Self::Table, typename Related::Table>) {
+            using Col = typename ForeignKeyTo<typename Self::Table, typename Related::Table>::Referenced;
+            std::unordered_map<typename Col::value_type, std::unique_ptr<Related>> r;
+            return forEachRelatedRow<Related>(db, objects, [&db, &r] (typename Related::Row &&row) {
+                auto key = detail::key_value<Col>(std::get<Related::Table::template column_index<Col>()>(row));
+                cacheRelatedRow<Related>(db, row);
+                r.insert_or_assign(key.value(), std::make_unique<Related>(db, std::move(row)));
+            }, opts...).map([&r] () {
+                return std::move(r);
+            });
+        } else {
+            using Col = typename ForeignKeyTo<typename Related::Table, typename Self::Table>::Column;
+            std::unordered_map<typename Col::value_type, std::vector<std::unique_ptr<Related>>> r;
+            return forEachRelatedRow<Related>(db, objects, [&db, &r] (typename Related::Row &&row) {
+                auto key = detail::key_value<Col>(std::get<Related::Table::template column_index<Col>()>(row));
+                cacheRelatedRow<Related>(db, row);
+                r[key.value()].push_back(std::make_unique<Related>(db, std::move(row)));
+            }, opts...).map([&r] () {
+                return std::move(r);
+            });
+        }
+    }
 
-        // Pure Insert
-        static QString sql_insert = QStringLiteral("INSERT INTO %0 (%1) VALUES (%2)")
-                .arg(Self::Table::name.value)
-                .arg(columns.join(", "))
-                .arg(placeholders.join(", "));
+private:
+    // Distinct non-NULL values of Col in objects
+    template <typename Col, typename Range>
+    static std::vector<typename Col::value_type> relationKeys(const Range &objects) {
+        std::vector<typename Col::value_type> keys;
+        for (const auto &o : objects)
+            if (auto k = detail::key_value<Col>(detail::object_ref<Self>(o).get(Col())))
+                keys.push_back(std::move(k).value());
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        return keys;
+    }
 
-        QString query = sql_insert;
+    // Call f with each row of Related whose Col is one of keys
+    template <typename Related, typename Col, typename Key, typename F, typename... Opts>
+    static DBResult<void> forEachRowIn(Database &db, const std::vector<Key> &keys, F &&f, Opts... opts) {
+        for (size_t i = 0; i < keys.size(); i += detail::in_batch_size) {
+            std::vector<Key> batch(keys.begin() + i, keys.begin() + std::min(keys.size(), i + detail::in_batch_size));
+            auto r = db.forEachRow<typename Related::Table>(
+                    Related::table.sqlSelect(Util::ORM::Sel::Where(Col().in(std::move(batch))), opts...), f);
+            if (!r)
+                return r;
+        }
+        return Ok();
+    }
+
+    // Call f with each row of Related referenced by or referencing one of objects
+    template <typename Related, typename Range, typename F, typename... Opts>
+    static DBResult<void> forEachRelatedRow(Database &db, const Range &objects, F &&f, Opts... opts) {
+        using namespace Util::ORM;
+        if constexpr (has_foreign_key_to<typename Self::Table, typename Related::Table>) {
+            using FK = ForeignKeyTo<typename Self::Table, typename Related::Table>;
+            return forEachRowIn<Related, typename FK::Referenced>(db, relationKeys<typename FK::Column>(objects), f, opts...);
+        } else {
+            using FK = ForeignKeyTo<typename Related::Table, typename Self::Table>;
+            return forEachRowIn<Related, typename FK::Column>(db, relationKeys<typename FK::Referenced>(objects), f, opts...);
+        }
+    }
+
+    template <typename Related>
+    static void cacheRelatedRow(Database &db, const typename Related::Row &row) {
+        using IdCol = std::decay_t<decltype(Related::id)>;
+        if (auto id = detail::key_value<IdCol>(std::get<Related::Table::template column_index<IdCol>()>(row)))
+            db.cacheRow<typename Related::Table>(id.value(), row);
+    }
+
+public:
+    // Save to DB
+    /**
+     * @brief Write the object's changes
+     * New objects are inserted. For existing ones only the dirty columns are updated,
+     * and nothing is written if none are dirty.
+     * @return The row ID
+     */
+    DBResult<long> save() {
+        static_assert(Self::Table::Columns::size < 64, "Too many columns");
+        auto &row = static_cast<Self*>(this)->row;
 
-        // Upsert if exists
         long id = getId();
-#if 1
         if (id > 0) { // invalid ID can't exist
-            static QString sql_upsert_tmpl = QStringLiteral(" ON CONFLICT (id) DO UPDATE SET (%0) = (%1)");
+            const auto &dirty = row.get_dirty();
+            quint64 mask = 0;
+            for (size_t i = 1; i < dirty.size(); i++) // ID column should never have to be updated
+                if (dirty[i])
+                    mask |= quint64(1) << i;
+
+            if (!mask)
+                return Ok(id);
+
+            // Update statements by dirty column mask, binding the dirty columns and then the ID.
+            // Per thread, objects are saved from the GUI and DatabaseWorker threads alike
+            static thread_local QHash<quint64, QString> sql_updates;
+            static const QStringList columns = Self::Table::getColumnNames();
+
+            auto it = sql_updates.find(mask);
+            if (it == sql_updates.end()) {
+                QStringList sets;
+                for (int i = 0; i < columns.size(); i++)
+                    if ((mask >> i) & 1)
+                        sets.append(columns[i] + QStringLiteral(" = ?"));
+
+                it = sql_updates.insert(mask, QStringLiteral("UPDATE %0 SET %1 WHERE id = ?;")
+                                        .arg(Util::ORM::tstring_qstring(Self::Table::name), sets.join(", ")));
+            }
 
-            QStringList update_cols;
-            QStringList update_phs;
-            const auto &dirty = static_cast<Self*>(this)->row.get_dirty();
+            auto r = database().execute(Util::ORM::SQL{it.value(), std::tuple_cat(row.get(), std::tuple<long>(id))},
+                                        mask | quint64(1) << Self::Table::Columns::size);
+            if (!r)
+                return Err(std::move(r).error());
 
-            for (int i = 0; i < columns.size(); i++)
-                if (dirty[i]) {
-                    assert(i != 0); // ID column should never have to be updated
-                    update_cols.append(columns[i]);
-                    update_phs.append(placeholders[i]);
-                }
+            database().template uncacheRow<typename Self::Table>(id);
 
-            query.append(sql_upsert_tmpl.arg(update_cols.join(", ")).arg(update_phs.join(", ")));
+            // Rows with a preset ID are inserted below
+            if (database().rowsAffected() > 0) {
+                row.reset_dirty();
+                recordWrite(database(), row.get(), id, RowChange::Updated, mask);
+                return Ok(id);
+            }
         }
-#endif
 
-        // Prepare
-        //qDebug() << "Save/SQL:" << query;
-        auto q = database().prepare(query);
-
-        Util::tuple_enumerate_foreach(Self::Table::columns, [&q, this, id] (size_t i, auto col) {
-            QVariant v;
-            if constexpr (col.is_nullable) {
-                    using Opt = typename decltype(col)::nullable_type;
-                    auto opt = static_cast<Self*>(this)->row.get(col);
-                    if (!Opt::is_unit(opt))
-                        v = QVariant::fromValue(Opt::get(opt));
-            } else
-                v = QVariant::fromValue(static_cast<Self*>(this)->row.get(col));
-            //qDebug() << "Save/bind:" << placeholders[i] << v;
-            q.bindValue(placeholders[i], v);
-        });
-
-        //qDebug() << "Save/bound:" << q.boundValues();
-
-        // Execute
-        if (!q.exec())
-            return Err(q.lastError());
+        auto r = database().execute(Util::ORM::SQL{Util::ORM::tstring_qstring(sqlInsertText()), row.get()});
+        if (!r)
+            return Err(std::move(r).error());
 
         if (id < 0) {
-            id = q.lastInsertId().toInt();
+            id = database().lastInsertId();
             this->set(this->id, id);
         }
 
-        static_cast<Self*>(this)->row.reset_dirty();
+        row.reset_dirty();
+        recordWrite(database(), row.get(), id, RowChange::Inserted);
 
         return Ok(id);
     }
 
+    /**
+     * @brief Save a range of objects in a single transaction
+     * @param objects   Range of Self, Self* or std::unique_ptr<Self>
+     * New objects receive their row ID just like with save().
+     */
+    template <typename Range>
+    static DBResult<void> saveAll(Database &db, Range &objects) {
+        return db.transaction([&objects] () -> DBResult<void> {
+            for (auto &o : objects) {
+                auto r = detail::object_ref<Self>(o).save();
+                if (!r)
+                    return r.discard();
+            }
+            return Ok();
+        });
+    }
+
+    /**
+     * @brief Insert plain rows in a single transaction
+     * @param rows  Range of Row tuples. Rows with an empty id get a new one.
+     * @return The row ID of each inserted row
+     */
+    template <typename Range>
+    static DBResult<std::vector<long>> insertMany(Database &db, const Range &rows) {
+        using Row = typename Self::Row;
+        static constexpr auto sql_insert = sqlInsertText();
+
+        return db.transaction([&db, &rows] () -> DBResult<std::vector<long>> {
+            std::vector<long> ids;
+            if constexpr (requires {std::size(rows);})
+                ids.reserve(std::size(rows));
+
+            for (const Row &row : rows) {
+                auto r = db.execute(Util::ORM::SQL{Util::ORM::tstring_qstring(sql_insert), row});
+                if (!r)
+                    return Err(std::move(r).error());
+
+                ids.push_back(db.lastInsertId());
+                recordWrite(db, row, ids.back(), RowChange::Inserted);
+            }
+
+            return Ok(std::move(ids));
+        });
+    }
+
+    /**
+     * @brief Save the dirty columns on a worker thread
+     * The object counts as saved right away. Should the write fail, the error is logged
+     * and the columns are dirty again, so the next save retries them.
+     * New objects are inserted synchronously instead, so they get their row ID.
+     * Defined in worker.h
+     */
+    void saveAsync(DatabaseWorker &worker);
+
     // Exported to QML as just save()
     Q_INVOKABLE QVariant saveInvokable() {
         auto r = save();
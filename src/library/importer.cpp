@@ -10,6 +10,7 @@
 
 #include "importer.h"
 #include "importer_metadata.h"
+#include "mpv/mpvprobe.h"
 #include "book.h"
 #include "chapter.h"
 #include "blob.h"
@@ -47,6 +48,18 @@ Importer::Importer(Database &db) :
 {
 }
 
+Importer::~Importer()
+{
+}
+
+MpvProbePool &Importer::probe_pool()
+{
+    // Only spin up mpv once something actually needs probing
+    if (!mp_probe_pool)
+        mp_probe_pool = std::make_unique<MpvProbePool>();
+    return *mp_probe_pool;
+}
+
 DBResult<std::unordered_set<std::string>> Importer::inventory()
 {
     auto q = db.prepare("SELECT media FROM Chapter;");
@@ -102,27 +115,82 @@ DBResult<void> Importer::process_dir(const std::set<fs::path> &files) {
 
     // Analyze files
     std::vector<MediaInfo> items;
+    std::vector<fs::path> probe;
     QImage cover_file;
 
     qDebug() << "Processing directory:" << (*files.cbegin()).parent_path().filename().c_str();
 
+    // CUE sheets turn a single media file into virtual chapters
+    std::set<fs::path> cue_media;
+
+    for (auto &file : files) {
+        if (!mimedb.mimeTypeForFile(QString::fromStdString(file)).inherits("application/x-cue"))
+            continue;
+
+        auto sheet = cue_parse(file);
+        if (!sheet)
+            continue;
+
+        for (auto &cue_file : sheet->files) {
+            // Media already in the library or missing altogether, or
+            // described by another sheet, e.g. album.cue and album.flac.cue
+            if (!files.count(cue_file.media) || cue_media.count(cue_file.media))
+                continue;
+
+            auto info = cue_process(*sheet, cue_file);
+            if (!info)
+                continue;
+
+            items.emplace_back(std::move(info.value()));
+            cue_media.emplace(cue_file.media);
+        }
+    }
+
     for (auto &file : files) {
+        if (cue_media.count(file))
+            continue;
+
         auto qname = QString::fromStdString(file);
         auto type = mimedb.mimeTypeForFile(qname);
+        std::optional<MediaInfo> info;
 
         if      (type.inherits("audio/ogg"))
-            items.emplace_back(ogg_process(file, type));
+            info = ogg_process(file, type);
         else if (type.inherits("audio/x-m4a")
               || type.inherits("audio/mp4")
               || type.inherits("audio/x-m4b"))
-            items.emplace_back(isobmff_process(file, type));
+            info = isobmff_process(file, type);
         else if (type.inherits("audio/mpeg"))
-            items.emplace_back(mpeg_process(file));
+            info = mpeg_process(file);
         else if (QImageReader::supportedMimeTypes().contains(type.name().toUtf8())) {
             auto ciname = str_lower(file.filename().native());
             if (cover_file.isNull())
                 //if (!ciname.find("cover"))
                     cover_file = QImage(qname);
+            continue;
+        } else if (!type.name().startsWith("audio/") || type.inherits("text/plain")) {
+            // Not audio, or a playlist
+            continue;
+        }
+
+        if (info)
+            items.emplace_back(std::move(info.value()));
+        else
+            probe.emplace_back(file);
+    }
+
+    // Fall back to mpv for anything the native parsers rejected
+    if (!probe.empty()) {
+        auto results = probe_pool().probe(probe);
+        for (size_t i = 0; i < probe.size(); i++) {
+            std::optional<MediaInfo> info;
+            if (results[i])
+                info = probe_process(probe[i], results[i].value());
+
+            if (info)
+                items.emplace_back(std::move(info.value()));
+            else
+                qWarning() << "Could not import" << probe[i].c_str();
         }
     }
 
@@ -173,101 +241,102 @@ DBResult<void> Importer::process_dir(const std::set<fs::path> &files) {
     for (auto &it : books) {
         // TODO: Also consider author and reader above?
         const MediaInfo &info = it.second.front();
-        auto r = db.select<Book>(Book::title == info.title)
-                    .bind([this, &info, &it, cover_file] (std::vector<std::unique_ptr<Book>> &&books) -> DBResult<void> {
-                std::unique_ptr<Book> b;
-                if (books.size() < 1) {
-                    // Create new book
-                    b = std::make_unique<Book>(db, info.title, info.author, info.reader);
-                    auto r = b->save();
-                    if (!r) return r.discard();
-                } else if (books.size() > 1) {
-                    // TODO: Deal with it?
-                    assert(false && "More than one book with the same title");
-                } else {
-                    // Found book in database
-                    b = std::move(books[0]);
-                }
+        // Each book with its chapters is added atomically
+        auto r = db.transaction([this, &info, &it, &cover_file] () -> DBResult<void> {
+            return db.select<Book>(Book::title == info.title)
+                        .bind([this, &info, &it, cover_file] (std::vector<std::unique_ptr<Book>> &&books) -> DBResult<void> {
+                    std::unique_ptr<Book> b;
+                    if (books.size() < 1) {
+                        // Create new book
+                        b = std::make_unique<Book>(db, info.title, info.author, info.reader);
+                        auto r = b->save();
+                        if (!r) return r.discard();
+                    } else if (books.size() > 1) {
+                        // TODO: Deal with it?
+                        assert(false && "More than one book with the same title");
+                    } else {
+                        // Found book in database
+                        b = std::move(books[0]);
+                    }
 
-                qDebug() << "Found Book" << info.title << "by" << info.author;
-
-                // Handle cover
-                if (!cover_file.isNull() && !b->get(Book::cover_blob_id).has_value()) {
-                    // Scale image
-                    QByteArray data;
-                    QBuffer buf(&data);
-                    buf.open(QIODevice::WriteOnly);
-                    cover_file.scaled(500, 500, Qt::KeepAspectRatio).save(&buf, "PNG");
-                    buf.close();
-
-                    // Save blob
-                    Blob cover(db, data);
-                    auto r = cover.save().bind([&b] (long id) {
-                        b->set(Book::cover_blob_id, id);
-                        return b->save();
-                    });
-                    if (!r) return r.discard();
-                }
+                    qDebug() << "Found Book" << info.title << "by" << info.author;
+
+                    // Handle cover
+                    if (!cover_file.isNull() && !b->get(Book::cover_blob_id).has_value()) {
+                        // Scale image
+                        QByteArray data;
+                        QBuffer buf(&data);
+                        buf.open(QIODevice::WriteOnly);
+                        cover_file.scaled(500, 500, Qt::KeepAspectRatio).save(&buf, "PNG");
+                        buf.close();
+
+                        // Save blob
+                        Blob cover(db, data);
+                        auto r = cover.save().bind([&b] (long id) {
+                            b->set(Book::cover_blob_id, id);
+                            return b->save();
+                        });
+                        if (!r) return r.discard();
+                    }
 
-                auto mediae = it.second;
-
-                // Detect broken chapters
-                int renumber = [&](){
-                    if (mediae.size() <= 1 && !mediae[0].multi_chapter)
-                        return 0;
-                    std::vector<int> numbers;
-                    for (auto &info : mediae)
-                        for (auto &chap : info.chapters)
-                            numbers.push_back(chap.no);
-                    std::sort(numbers.begin(), numbers.end());
-                    int expect = 1;
-                    int result = 0;
-                    for (int i : numbers) {
-                        if (i & 0xFFFF0000)
-                            result = 2;
-                        if (i < expect)
-                            return 1;
-                        else
-                            expect = i;
+                    auto mediae = it.second;
+
+                    // Detect broken chapters
+                    int renumber = [&](){
+                        if (mediae.size() <= 1 && !mediae[0].multi_chapter)
+                            return 0;
+                        std::vector<int> numbers;
+                        for (auto &info : mediae)
+                            for (auto &chap : info.chapters)
+                                numbers.push_back(chap.no);
+                        std::sort(numbers.begin(), numbers.end());
+                        int expect = 1;
+                        int result = 0;
+                        for (int i : numbers) {
+                            if (i & 0xFFFF0000)
+                                result = 2;
+                            if (i < expect)
+                                return 1;
+                            else
+                                expect = i;
+                        }
+                        return result;
+                    }();
+
+
+                    if (renumber == 1) {
+                        // Last resort: renumber by filename sorting
+                        // Make sure filenames are sorted if we're renumbering
+                        QCollator collate;
+                        collate.setNumericMode(true);
+                        std::sort(mediae.begin(), mediae.end(), [&collate](auto& a, auto& b) {
+                            return collate.compare(a.media, b.media) < 0;
+                        });
+                    } else if (renumber == 2) {
+                        // renumber by old chapter numbers, but still renumber
+                        std::sort(mediae.begin(), mediae.end(), [](auto& a, auto& b) {
+                            return a.chapters.front().no < b.chapters.front().no;
+                        });
                     }
-                    return result;
-                }();
-
-
-                if (renumber == 1) {
-                    // Last resort: renumber by filename sorting
-                    // Make sure filenames are sorted if we're renumbering
-                    QCollator collate;
-                    collate.setNumericMode(true);
-                    std::sort(mediae.begin(), mediae.end(), [&collate](auto& a, auto& b) {
-                        return collate.compare(a.media, b.media) < 0;
-                    });
-                } else if (renumber == 2) {
-                    // renumber by old chapter numbers, but still renumber
-                    std::sort(mediae.begin(), mediae.end(), [](auto& a, auto& b) {
-                        return a.chapters.front().no < b.chapters.front().no;
-                    });
-                }
 
-                // Add chapters
-                int renumber_count = 0;
-                for (auto &info : mediae) {
-                    // Add chapters from info
-                    int mc_count = 0;
-                    for (auto & chap : info.chapters) {
-                        long chapter_no = renumber? ++renumber_count: chap.no;
-                        // only set media_chapter for files that actually contain multiple chapters
-                        std::optional<int> mc = info.multi_chapter ? std::optional(++mc_count) : std::nullopt;
-                        qDebug() << "> Found Chapter" << chapter_no << chap.name << "from" << info.media.mid(info.media.lastIndexOf('/')+1) << mc.value_or(0);
-                        Chapter c(db, *b, chapter_no, chap.get_length(), info.media, chap.start, mc, chap.name);
-                        auto r = c.save();
-                        if (!r)
-                            return r.discard();
+                    // Add chapters
+                    std::vector<std::unique_ptr<Chapter>> chapters;
+                    int renumber_count = 0;
+                    for (auto &info : mediae) {
+                        // Add chapters from info
+                        int mc_count = 0;
+                        for (auto & chap : info.chapters) {
+                            long chapter_no = renumber? ++renumber_count: chap.no;
+                            // only set media_chapter for files that actually contain multiple chapters
+                            std::optional<int> mc = info.multi_chapter ? std::optional(++mc_count) : std::nullopt;
+                            qDebug() << "> Found Chapter" << chapter_no << chap.name << "from" << info.media.mid(info.media.lastIndexOf('/')+1) << mc.value_or(0);
+                            chapters.push_back(std::make_unique<Chapter>(db, *b, chapter_no, chap.get_length(), info.media, chap.start, mc, chap.name));
+                        }
                     }
-                }
 
-                return Ok();
-            });
+                    return Chapter::saveAll(db, chapters);
+                });
+        });
 
         if (!r) return r;
     }
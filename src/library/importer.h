@@ -3,6 +3,7 @@
 #include "database.h"
 
 #include <filesystem>
+#include <memory>
 #include <set>
 #include <unordered_set>
 
@@ -10,6 +11,7 @@
 #include <QSet>
 #include <QMimeType>
 
+class MpvProbePool;
 
 namespace Midoku::Library {
 
@@ -22,6 +24,9 @@ class Importer : public QObject
     Q_OBJECT
 
     Database &db;
+    std::unique_ptr<MpvProbePool> mp_probe_pool;
+
+    MpvProbePool &probe_pool();
 
     DBResult<std::unordered_set<std::string>> inventory();
 
@@ -31,6 +36,7 @@ public:
     static const QSet<QString> supported_types;
 
     explicit Importer(Database &db);
+    virtual ~Importer();
 
 signals:
     void progress(int current, int max, const QString &message);
@@ -0,0 +1,184 @@
+#include "importer_metadata.h"
+
+#include <taglib/fileref.h>
+#include <taglib/tpropertymap.h>
+
+#include <algorithm>
+
+#include <QFile>
+#include <QTextStream>
+#include <QDebug>
+
+namespace fs = std::filesystem;
+
+
+namespace Midoku::Library {
+
+// ----------------------------------------------------------------------------
+// CUE sheet parsing
+static QStringList cue_tokenize(const QString &line) {
+    QStringList tokens;
+    QString cur;
+    bool quoted = false;
+    bool have_token = false;
+
+    for (QChar c : line) {
+        if (c == '"') {
+            quoted = !quoted;
+            have_token = true;
+        } else if (!quoted && c.isSpace()) {
+            if (have_token)
+                tokens.append(cur);
+            cur.clear();
+            have_token = false;
+        } else {
+            cur.append(c);
+            have_token = true;
+        }
+    }
+    if (have_token)
+        tokens.append(cur);
+
+    return tokens;
+}
+
+// mm:ss:ff, 75 frames per second
+static inline std::optional<int64_t> cue_parse_index(const QString &s) {
+    auto parts = s.splitRef(':');
+    if (parts.size() != 3)
+        return std::nullopt;
+    bool ok_m, ok_s, ok_f;
+    int64_t m = parts[0].toLongLong(&ok_m);
+    int64_t sec = parts[1].toLongLong(&ok_s);
+    parts[2].toInt(&ok_f);
+    if (!ok_m || !ok_s || !ok_f)
+        return std::nullopt;
+    return m * 60 + sec;
+}
+
+std::optional<CueSheet> cue_parse(const fs::path &file) {
+    QFile f(QString::fromStdString(file.native()));
+    if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning() << "CUE: Could not open" << file.c_str();
+        return std::nullopt;
+    }
+
+    QTextStream stream(&f);
+    stream.setCodec("UTF-8");
+    stream.setAutoDetectUnicode(true);
+
+    CueSheet sheet;
+    CueFile *cur_file = nullptr;
+    CueTrack *cur_track = nullptr;
+    // INDEX 00 is only used if a track has no INDEX 01
+    bool have_index1 = false;
+
+    while (!stream.atEnd()) {
+        auto tokens = cue_tokenize(stream.readLine());
+        if (tokens.isEmpty())
+            continue;
+
+        auto cmd = tokens[0].toUpper();
+
+        if (cmd == "FILE" && tokens.size() >= 2) {
+            sheet.files.emplace_back(CueFile{file.parent_path() / tokens[1].toStdString()});
+            cur_file = &sheet.files.back();
+            cur_track = nullptr;
+        } else if (cmd == "TRACK" && tokens.size() >= 3) {
+            if (!cur_file) {
+                qWarning() << "CUE: TRACK before FILE in" << file.c_str();
+                return std::nullopt;
+            }
+            if (tokens[2].toUpper() != "AUDIO") {
+                cur_track = nullptr;
+                continue;
+            }
+            cur_file->tracks.emplace_back(CueTrack{tokens[1].toInt()});
+            cur_track = &cur_file->tracks.back();
+            have_index1 = false;
+        } else if (cmd == "INDEX" && tokens.size() >= 3 && cur_track) {
+            int no = tokens[1].toInt();
+            auto start = cue_parse_index(tokens[2]);
+            if (!start)
+                qWarning() << "CUE: Bad INDEX" << tokens[2] << "in" << file.c_str();
+            else if (no == 1) {
+                cur_track->start = start.value();
+                have_index1 = true;
+            } else if (no == 0 && !have_index1)
+                cur_track->start = start.value();
+        } else if (cmd == "TITLE" && tokens.size() >= 2) {
+            if (cur_track)
+                cur_track->title = tokens[1];
+            else
+                sheet.title = tokens[1];
+        } else if (cmd == "PERFORMER" && tokens.size() >= 2) {
+            if (cur_track)
+                cur_track->performer = tokens[1];
+            else
+                sheet.performer = tokens[1];
+        }
+        // REM, CATALOG, FLAGS etc. are ignored
+    }
+
+    // Drop files without audio tracks
+    sheet.files.erase(std::remove_if(sheet.files.begin(), sheet.files.end(), [](const CueFile &f) {
+        return f.tracks.empty();
+    }), sheet.files.end());
+
+    if (sheet.files.empty())
+        return std::nullopt;
+
+    return sheet;
+}
+
+
+// ----------------------------------------------------------------------------
+// Virtual chapters
+std::optional<MediaInfo> cue_process(const CueSheet &sheet, const CueFile &file) {
+    ImportState s(file.media);
+
+    // Read length and whatever tags TagLib can find in the media itself
+    TagLib::FileRef ref(file.media.c_str());
+    if (ref.isNull() || !ref.audioProperties()) {
+        qWarning() << "CUE: Could not read audio properties of" << file.media.c_str();
+        return std::nullopt;
+    }
+
+    s.readAudioProperties(ref.audioProperties());
+
+    for (auto &kv : ref.file()->properties())
+        s.handleCommonTags(kv.first.upper(), kv.second);
+
+    // The sheet knows better than the embedded tags
+    if (!sheet.title.isNull())
+        s.title = sheet.title;
+    if (!sheet.performer.isNull()) {
+        s.artist = sheet.performer;
+    } else {
+        // Sheets without a global PERFORMER often repeat it for every track
+        QString performer;
+        bool same = !file.tracks.empty();
+        for (auto &track : file.tracks) {
+            if (performer.isNull())
+                performer = track.performer;
+            same = same && !track.performer.isNull() && track.performer == performer;
+        }
+        if (same)
+            s.artist = performer;
+    }
+
+    for (auto &track : file.tracks) {
+        if (track.start >= s.length) {
+            qWarning() << "CUE: Track" << track.no << "starts past the end of" << file.media.c_str();
+            continue;
+        }
+        s.chaps.emplace(track.no, ChapterInfo{.no=track.no, .start=track.start, .name=track.title});
+    }
+
+    if (!s.finalize())
+        return std::nullopt;
+
+    return s.info;
+}
+
+}
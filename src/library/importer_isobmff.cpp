@@ -10,12 +10,97 @@
 #include <array>
 #include <utility>
 #include <cstring>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
 
 #include <QDebug>
 
 
 namespace Midoku::Library {
 
+// ----------------------------------------------------------------------------------------------------------
+// Fragmented files
+struct isobmff_track {
+    uint32_t timescale = 0;
+    uint32_t default_sample_duration = 0; // from trex
+};
+
+// Exact duration from the segment index
+static int64_t isobmff_sidx_duration(std::istream &fs, const std::vector<isobmff::atom_header> &sidx_atoms) {
+    using namespace isobmff;
+
+    uint32_t reference_id = 0;
+    uint32_t timescale = 0;
+    uint64_t duration = 0;
+
+    // Only count the first referenced track. Hierarchical indices are fine,
+    // since only references to media are summed up.
+    for (auto &h : sidx_atoms) {
+        auto sidx = read_atom<atom::sidx>(fs, h);
+        if (!timescale) {
+            reference_id = sidx.reference_id;
+            timescale = sidx.timescale;
+        } else if (sidx.reference_id != reference_id)
+            continue;
+        duration += sidx.duration();
+    }
+
+    return timescale ? duration / timescale : 0;
+}
+
+// Walk the moof headers. mdat payloads are skipped over entirely
+static int64_t isobmff_moof_duration(std::istream &fs, const std::vector<isobmff::atom_header> &moof_atoms,
+                                     std::unordered_map<uint32_t, isobmff_track> &tracks) {
+    using namespace isobmff;
+
+    std::unordered_map<uint32_t, uint64_t> track_end;
+
+    for (auto &moof : moof_atoms) {
+        for (auto traf = AtomParser(fs, moof); traf; ++traf) {
+            if (!traf->is("traf"))
+                continue;
+
+            atom_header tfhd_atom;
+            atom_header tfdt_atom;
+            std::vector<atom_header> trun_atoms;
+
+            for (auto c = traf.children(); c; ++c) {
+                if (c->is("tfhd"))
+                    tfhd_atom = c.current();
+                else if (c->is("tfdt"))
+                    tfdt_atom = c.current();
+                else if (c->is("trun"))
+                    trun_atoms.push_back(c.current());
+            }
+
+            if (!tfhd_atom)
+                continue;
+
+            auto tfhd = read_atom<atom::tfhd>(fs, tfhd_atom);
+            auto &end = track_end[tfhd.track_id];
+            auto default_duration = tfhd.has_default_sample_duration() ?
+                        tfhd.default_sample_duration : tracks[tfhd.track_id].default_sample_duration;
+
+            // Without tfdt, fragments are contiguous
+            uint64_t time = tfdt_atom ? read_atom<atom::tfdt>(fs, tfdt_atom).base_media_decode_time : end;
+            for (auto &trun_atom : trun_atoms)
+                time += read_atom<atom::trun>(fs, trun_atom).duration(default_duration);
+
+            end = std::max(end, time);
+        }
+    }
+
+    int64_t length = 0;
+    for (auto [id, end] : track_end) {
+        auto timescale = tracks[id].timescale;
+        if (timescale)
+            length = std::max<int64_t>(length, end / timescale);
+    }
+    return length;
+}
+
+
 // ----------------------------------------------------------------------------------------------------------
 // Metadata
 static bool isobmff_chapters(ImportState &import, const std::filesystem::path &p) {
@@ -27,14 +112,47 @@ static bool isobmff_chapters(ImportState &import, const std::filesystem::path &p
     atom_header mdhd_atom;
     atom_header mvhd_atom;
     atom_header chpl_atom;
+    atom_header mvex_atom;
+    atom_header mehd_atom;
+    std::vector<atom_header> sidx_atoms;
+    std::vector<atom_header> moof_atoms;
+    std::unordered_map<uint32_t, isobmff_track> tracks;
 
     for (auto a = AtomParser(fs); a; ++a) {
         if (a->is("moov")) {
             for (auto b = a.children(); b; ++b) {
                 if (b->is("mvhd")) {
                     mvhd_atom = b.current();
-                } else if (b->is("mdhd")) {
-                    mdhd_atom = b.current();
+                } else if (b->is("trak")) {
+                    atom_header tkhd_atom;
+                    atom_header trak_mdhd_atom;
+                    for (auto c = b.children(); c; ++c) {
+                        if (c->is("tkhd")) {
+                            tkhd_atom = c.current();
+                        } else if (c->is("mdia")) {
+                            for (auto d = c.children(); d; ++d) {
+                                if (d->is("mdhd")) {
+                                    trak_mdhd_atom = d.current();
+                                    break;
+                                }
+                            }
+                        }
+                    }
+                    if (trak_mdhd_atom && !mdhd_atom)
+                        mdhd_atom = trak_mdhd_atom;
+                    if (tkhd_atom && trak_mdhd_atom)
+                        tracks[read_atom<atom::tkhd>(fs, tkhd_atom).track_id].timescale =
+                                read_atom<atom::mdhd>(fs, trak_mdhd_atom).timescale;
+                } else if (b->is("mvex")) {
+                    mvex_atom = b.current();
+                    for (auto c = b.children(); c; ++c) {
+                        if (c->is("mehd")) {
+                            mehd_atom = c.current();
+                        } else if (c->is("trex")) {
+                            auto trex = read_atom<atom::trex>(fs, c.current());
+                            tracks[trex.track_id].default_sample_duration = trex.default_sample_duration;
+                        }
+                    }
                 } else if (b->is("udta")) {
                     for (auto c = b.children(); c; ++c) {
                         if (c->is("chpl")) {
@@ -44,16 +162,37 @@ static bool isobmff_chapters(ImportState &import, const std::filesystem::path &p
                     }
                 }
             }
+        } else if (a->is("sidx")) {
+            sidx_atoms.push_back(a.current());
+        } else if (a->is("moof")) {
+            moof_atoms.push_back(a.current());
         }
     }
 
     // --- Duration ---
-    if (mdhd_atom) {
+    // mdhd/mvhd of fragmented files only cover the samples in moov, if any
+    if (mvex_atom || !moof_atoms.empty()) {
+        if (!sidx_atoms.empty())
+            import.length = isobmff_sidx_duration(fs, sidx_atoms);
+        if (import.length <= 0 && mehd_atom && mvhd_atom) {
+            auto mehd = read_atom<atom::mehd>(fs, mehd_atom);
+            auto mvhd = read_atom<atom::mvhd>(fs, mvhd_atom);
+            if (mvhd.timescale > 0)
+                import.length = mehd.fragment_duration / mvhd.timescale;
+        }
+        if (import.length <= 0)
+            import.length = isobmff_moof_duration(fs, moof_atoms, tracks);
+    }
+
+    if (import.length <= 0 && mdhd_atom) {
         auto mdhd = read_atom<atom::mdhd>(fs, mdhd_atom);
-        import.length = mdhd.duration_s();
-    } else if (mvhd_atom) {
+        if (mdhd.timescale > 0)
+            import.length = mdhd.duration_s();
+    }
+    if (import.length <= 0 && mvhd_atom) {
         auto mvhd = read_atom<atom::mvhd>(fs, mvhd_atom);
-        import.length = mvhd.duration / mvhd.timescale;
+        if (mvhd.timescale > 0)
+            import.length = mvhd.duration / mvhd.timescale;
     }
 
     qDebug() << "MP4 Duration: " << import.length;
@@ -83,13 +222,15 @@ static bool isobmff_chapters(ImportState &import, const std::filesystem::path &p
     return !import.chaps.empty();
 }
 
-MediaInfo isobmff_process(const std::filesystem::path &file, const QMimeType &type) {
+std::optional<MediaInfo> isobmff_process(const std::filesystem::path &file, const QMimeType &type) {
     Q_UNUSED(type)
     ImportState s(file);
 
     // TagLib
     {
         TagLib::MP4::File isobmf(file.c_str());
+        if (!isobmf.isValid())
+            return std::nullopt;
         // Get duration from isombff_chapters() later
 
         // Read simple stuff
@@ -141,7 +282,8 @@ MediaInfo isobmff_process(const std::filesystem::path &file, const QMimeType &ty
     // Chapters in ISOBMFF are a royal pain.
     isobmff_chapters(s, file);
 
-    s.finalize();
+    if (!s.finalize())
+        return std::nullopt;
 
     return s.info;
 }
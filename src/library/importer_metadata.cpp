@@ -32,7 +32,10 @@ bool ImportState::finalize() {
     }
 
     // Handle chapters
-    assert(length != 0);
+    if (length <= 0) {
+        qWarning() << "Import: Could not determine length of" << path.c_str();
+        return false;
+    }
     if (!chaps.size()) {
         // File is single chapter
         info.multi_chapter = false;
@@ -103,7 +106,7 @@ static inline int ogg_parse_chapter_start(const TagLib::String &str) {
     return h*3600 + m*60 + s;
 }
 
-MediaInfo ogg_process(const fs::path &file, const QMimeType &type) {
+std::optional<MediaInfo> ogg_process(const fs::path &file, const QMimeType &type) {
     ImportState s(file);
 
     auto ogg = [&file, &type] () -> std::unique_ptr<TagLib::Ogg::File> {
@@ -121,6 +124,9 @@ MediaInfo ogg_process(const fs::path &file, const QMimeType &type) {
                                      .toStdString());
     }();
 
+    if (!ogg->isValid())
+        return std::nullopt;
+
     s.readAudioProperties(ogg->audioProperties());
 
     for (auto &kv : ogg->properties()) {
@@ -171,15 +177,18 @@ MediaInfo ogg_process(const fs::path &file, const QMimeType &type) {
             }
     }
 
-    s.finalize();
+    if (!s.finalize())
+        return std::nullopt;
 
     return s.info;
 }
 
 // MP3
-MediaInfo mpeg_process(const fs::path &file) {
+std::optional<MediaInfo> mpeg_process(const fs::path &file) {
     ImportState s(file);
     TagLib::MPEG::File mp3(file.c_str());
+    if (!mp3.isValid())
+        return std::nullopt;
 
     s.readAudioProperties(mp3.audioProperties());
 
@@ -192,7 +201,8 @@ MediaInfo mpeg_process(const fs::path &file) {
             qDebug() << "Unknown MP3 TAG:" << tag.toCString() << "=" << tqstr(kv.second);
     }
 
-    s.finalize();
+    if (!s.finalize())
+        return std::nullopt;
 
     return s.info;
 }
@@ -2,6 +2,7 @@
 
 #include <unordered_map>
 #include <filesystem>
+#include <optional>
 
 #include <QString>
 #include <QImage>
@@ -10,6 +11,7 @@
 #include <taglib/audioproperties.h>
 #include <taglib/tstringlist.h>
 
+struct MpvProbeResult;
 
 namespace Midoku::Library {
 
@@ -64,7 +66,7 @@ inline QString tqstr(const TagLib::StringList &sl) {
 struct ImportState {
     const std::filesystem::path &path;
     MediaInfo info;
-    int64_t length;
+    int64_t length = 0;
     QString artist;
     QString album;
     QString title;
@@ -78,7 +80,8 @@ struct ImportState {
     {}
 
     inline void readAudioProperties(TagLib::AudioProperties *p) {
-        length = p->lengthInSeconds();
+        // TagLib returns no properties for files it couldn't parse
+        length = p ? p->lengthInSeconds() : 0;
     }
 
     inline bool handleCommonTags(const TagLib::String &tag, const TagLib::StringList &value) {
@@ -104,11 +107,40 @@ struct ImportState {
     bool finalize();
 };
 
+// These return std::nullopt when the file couldn't be parsed natively.
+// Such files should be handed to probe_process() instead
+
 // Simple MP3, OGG Vorbis/Opus/FLAC
-MediaInfo mpeg_process(const std::filesystem::path &file);
-MediaInfo ogg_process(const std::filesystem::path &file, const QMimeType &type);
+std::optional<MediaInfo> mpeg_process(const std::filesystem::path &file);
+std::optional<MediaInfo> ogg_process(const std::filesystem::path &file, const QMimeType &type);
 
 // ISOBMFF MP4/M4A/M4B
-MediaInfo isobmff_process(const std::filesystem::path &file, const QMimeType &type);
+std::optional<MediaInfo> isobmff_process(const std::filesystem::path &file, const QMimeType &type);
+
+// CUE sheets describing a single media file
+struct CueTrack {
+    int no = 0;
+    // INDEX 01 in sec. CUE frames (1/75s) are truncated
+    int64_t start = 0;
+    QString title;
+    QString performer;
+};
+
+struct CueFile {
+    std::filesystem::path media;
+    std::vector<CueTrack> tracks;
+};
+
+struct CueSheet {
+    QString title;
+    QString performer;
+    std::vector<CueFile> files;
+};
+
+std::optional<CueSheet> cue_parse(const std::filesystem::path &file);
+std::optional<MediaInfo> cue_process(const CueSheet &sheet, const CueFile &file);
+
+// Anything else, using the results of MpvProbePool
+std::optional<MediaInfo> probe_process(const std::filesystem::path &file, const MpvProbeResult &probe);
 
 }
@@ -0,0 +1,46 @@
+#include "importer_metadata.h"
+#include "mpv/mpvprobe.h"
+
+#include <QDebug>
+
+
+namespace Midoku::Library {
+
+// ----------------------------------------------------------------------------
+// Metadata from mpv
+std::optional<MediaInfo> probe_process(const std::filesystem::path &file, const MpvProbeResult &probe) {
+    ImportState s(file);
+
+    s.length = static_cast<int64_t>(probe.duration);
+
+    if (!probe.composer.isEmpty())
+        s.info.author = probe.composer;
+    if (!probe.artist.isEmpty())
+        s.artist = probe.artist;
+    if (!probe.album.isEmpty())
+        s.album = probe.album;
+    if (!probe.title.isEmpty())
+        s.title = probe.title;
+    if (!probe.track.isEmpty())
+        s.track = probe.track;
+    if (!probe.disc.isEmpty())
+        s.disc = probe.disc;
+
+    // A single chapter spanning the whole file is the same as none
+    if (probe.chapters.size() > 1) {
+        int no = 0;
+        for (auto &chap : probe.chapters) {
+            no++;
+            s.chaps.emplace(no, ChapterInfo{.no=no, .start=static_cast<int64_t>(chap.time), .name=chap.title});
+        }
+    }
+
+    qDebug() << "MpvProbe:" << file.c_str() << "Duration:" << s.length << "Chapters:" << probe.chapters.size();
+
+    if (!s.finalize())
+        return std::nullopt;
+
+    return s.info;
+}
+
+}
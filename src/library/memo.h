@@ -0,0 +1,77 @@
+#pragma once
+
+#include "database.h"
+
+#include <functional>
+#include <optional>
+
+#include <QObject>
+#include <QVariant>
+
+
+namespace Midoku::Library {
+
+/**
+ * @brief Memoized value of a computed QML property
+ * QObjects in the value, directly or in a QVariantList, become children of the
+ * property's object and are deleted when the value is reset.
+ */
+class Memo
+{
+    std::optional<QVariant> value;
+
+    template <typename F>
+    static void for_each_object(const QVariant &v, F &&f) {
+        if (v.userType() == QMetaType::QVariantList) {
+            for (const auto &x : v.toList())
+                for_each_object(x, f);
+        } else if (auto *o = qvariant_cast<QObject *>(v)) {
+            f(o);
+        }
+    }
+
+public:
+    Memo() = default;
+    Memo(const Memo &) = delete;
+
+    bool isValid() const {
+        return value.has_value();
+    }
+
+    /**
+     * @brief The memoized value, computing it if there is none
+     * @param compute   Returns DBResult<QVariant>. Errors are logged and not memoized.
+     */
+    template <typename F>
+    QVariant get(QObject *owner, F &&compute) {
+        if (!value) {
+            DBResult<QVariant> r = std::invoke(std::forward<F>(compute));
+            if (!r) {
+                qDebug() << "qml error:" << r.error();
+                return QVariant();
+            }
+            for_each_object(r.value(), [owner] (QObject *o) {
+                o->setParent(owner);
+            });
+            value = std::move(r).value();
+        }
+        return *value;
+    }
+
+    /**
+     * @return Whether there was a value to drop
+     */
+    bool reset() {
+        if (!value)
+            return false;
+
+        // QML may still be reading them until it sees the NOTIFY signal
+        for_each_object(*value, [] (QObject *o) {
+            o->deleteLater();
+        });
+        value.reset();
+        return true;
+    }
+};
+
+}
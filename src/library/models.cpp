@@ -13,4 +13,27 @@ QVariant TableModel::data(const QModelIndex &idx, int role) const {
     return QSqlQueryModel::data(this->index(idx.row(), role - Qt::UserRole));
 }
 
+// ---------------
+QHash<int, QByteArray> ObjectListModel::roleNames() const {
+    return m_roleNames;
+}
+
+void ObjectListModel::follow(ChangeFeed &feed, bool inserts, QStringList depends) {
+    m_depends = std::move(depends);
+    connect(&feed, &ChangeFeed::rowsChanged, this, [this, inserts] (const QVector<RowChange> &changes) {
+        applyChanges(changes, inserts);
+    });
+}
+
+// ---------------
+QVariant Book::getChapterModelV() {
+    return m_chapter_model.get(this, [this] () -> DBResult<QVariant> {
+        using namespace Util::ORM;
+        ObjectListModel *model = new ListModel<Chapter>(database(), this,
+                                                        Chapter::book_id == getId(), Sel::OrderBy(Chapter::chapter));
+        model->follow(database().changes(), false);
+        return Ok(QVariant::fromValue(model));
+    });
+}
+
 }
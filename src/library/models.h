@@ -2,10 +2,17 @@
 
 #include "book.h"
 #include "chapter.h"
+#include "worker.h"
 
+#include <QAbstractListModel>
+#include <QSet>
 #include <QSqlTableModel>
 #include <QSqlRelationalTableModel>
 
+#include <algorithm>
+#include <functional>
+#include <vector>
+
 
 namespace Midoku::Library {
 
@@ -30,4 +37,464 @@ public:
     Q_INVOKABLE virtual QVariant data(const QModelIndex &idx, int role = Qt::DisplayRole) const override;
 };
 
+
+
+/**
+ * @brief List model over the rows of an ORM table, fetched a page at a time
+ * Roles are the table's columns, rows are kept as plain tuples and only become
+ * objects through get().
+ */
+class ObjectListModel : public QAbstractListModel {
+    Q_OBJECT
+
+protected:
+    QHash<int, QByteArray> m_roleNames;
+    // Tables other than its own that the model's query reads
+    QStringList m_depends;
+
+    explicit ObjectListModel(QHash<int, QByteArray> roleNames, QObject *parent) :
+        QAbstractListModel(parent),
+        m_roleNames(std::move(roleNames))
+    {}
+
+public:
+    virtual QHash<int, QByteArray> roleNames() const override;
+
+    /**
+     * @brief The object for a row, owned by the caller
+     */
+    Q_INVOKABLE virtual QVariant get(int row) = 0;
+
+    // Fine-grained updates
+    /**
+     * @brief Re-read a loaded row
+     */
+    Q_INVOKABLE virtual void refreshRow(long id) = 0;
+    /**
+     * @brief Add a new row, if all rows before it have been fetched already
+     */
+    Q_INVOKABLE virtual void appendRow(long id) = 0;
+    Q_INVOKABLE virtual void dropRow(long id) = 0;
+    /**
+     * @brief Run the query again for the rows loaded so far, and apply the differences
+     */
+    Q_INVOKABLE virtual void reload() = 0;
+
+    /**
+     * @brief Apply the rows of this model's table from a batch of changes
+     * @param inserts   Whether new rows belong in the model. False for filtered models,
+     *                  which reload() instead, since only the query knows which rows match.
+     */
+    virtual void applyChanges(const QVector<RowChange> &changes, bool inserts) = 0;
+
+    /**
+     * @brief Keep up with the rows written to feed, see applyChanges()
+     * @param depends   Other tables the query reads, e.g. of a join. Filtered models reload on their changes too.
+     */
+    void follow(ChangeFeed &feed, bool inserts = true, QStringList depends = {});
+};
+
+
+template <typename Self>
+class ListModel : public ObjectListModel {
+public:
+    using Table = typename Self::Table;
+    using Row = typename Self::Row;
+
+    static constexpr size_t page_size = 64;
+
+private:
+    Database &db;
+    std::vector<Row> rows;
+    bool at_end = false;
+
+    // Keyset position in the model's order: sort key and id of the last row fetched
+    using Position = std::optional<std::pair<QVariant, long>>;
+    Position next_after;
+
+    // Appends up to limit rows following after, from the start for nullopt.
+    // Returns the position of the last row it appended, after if none.
+    using PageFn = std::function<DBResult<Position>(Database &db, const Position &after, size_t limit,
+                                                    std::vector<Row> &out)>;
+    PageFn fetch_page;
+
+    // Runs reload() off this thread if set
+    DatabaseWorker *worker = nullptr;
+    // Bumped whenever rows change other than by reload(), a pending reload is stale then
+    unsigned generation = 0;
+    bool reloading = false;
+    bool reload_again = false;
+
+    static QHash<int, QByteArray> makeRoleNames() {
+        return Util::tuple_enumerate_map<QHash<int, QByteArray>>(Table::columns, [](int i, auto col) {
+            return std::pair<int, QByteArray>(Qt::UserRole + i, col.name.value);
+        });
+    }
+
+    static long rowId(const Row &row) {
+        return std::get<0>(row).value_or(-1);
+    }
+
+    int indexOf(long id) const {
+        auto it = std::find_if(rows.begin(), rows.end(), [id] (const Row &r) {
+            return rowId(r) == id;
+        });
+        return it != rows.end() ? it - rows.begin() : -1;
+    }
+
+    DBResult<std::optional<Row>> loadRow(long id) {
+        std::optional<Row> r;
+        return db.forEachRow<Table>(Self::table.sqlSelect(Self::id == id), [&r] (Row &&row) {
+            r = std::move(row);
+            return false;
+        }).map([&r] () {
+            return std::move(r);
+        });
+    }
+
+    /**
+     * SELECT <Self's columns>, key FROM source WHERE filter AND (key, id) > (:key, :id)
+     * ORDER BY key, id LIMIT n, or < and DESC for descending keys
+     */
+    template <typename Src, typename... Fs, typename Key, bool Desc>
+    static PageFn keysetPages(Src source, Util::ORM::SQL<Fs...> filter, Util::ORM::Sel::OrderBy<Key, Desc> order) {
+        using namespace Util::ORM;
+        using KeyType = typename Key::type;
+        using Result = decltype(std::tuple_cat(std::declval<Row>(), std::declval<std::tuple<KeyType>>()));
+
+        auto key = order.expr.sqlExpression(0);
+        static_assert(std::tuple_size_v<decltype(key.binds)> == 0, "Sort keys can't have bound values");
+        auto columns = std::apply([&source] (auto... cols) {
+            return Sel::From(source, Self::table[cols]...);
+        }, Table::columns).sqlSelectColumns();
+        static_assert(std::tuple_size_v<decltype(columns.binds)> == 0, "Joins with bound values aren't supported");
+
+        QString select = QStringLiteral("SELECT %1, %2 FROM %3")
+                .arg(columns.query, key.query, tstring_qstring(Src::sqlTableText()));
+        QString id = Self::table[Self::id].sqlExpression(0).query;
+        QString past_key = QString::fromLatin1(Desc ? "(%1, %2) < (?, ?)" : "(%1, %2) > (?, ?)").arg(key.query, id);
+        QString order_by = QString::fromLatin1(Desc ? " ORDER BY %1 DESC, %2 DESC LIMIT ?;" : " ORDER BY %1, %2 LIMIT ?;")
+                .arg(key.query, id);
+
+        QString from_start, following;
+        if (filter.query.isEmpty()) {
+            from_start = select + order_by;
+            following = select + QStringLiteral(" WHERE ") + past_key + order_by;
+        } else {
+            from_start = select + QStringLiteral(" WHERE ") + filter.query + order_by;
+            following = select + QStringLiteral(" WHERE (%1) AND %2").arg(filter.query, past_key) + order_by;
+        }
+
+        return [filter_binds = filter.binds, from_start, following] (Database &db, const Position &after, size_t limit,
+                                                                     std::vector<Row> &out) {
+            auto read = [&db, &after, &out] (const auto &sql) {
+                return db.template rows<Result>(sql).bind([&after, &out] (Cursor<Result> &&c) {
+                    Position last = after;
+                    for (auto &r : c) {
+                        out.push_back([&r] <size_t... I> (std::index_sequence<I...>) {
+                            return Row{std::move(std::get<I>(r))...};
+                        }(std::make_index_sequence<std::tuple_size_v<Row>>()));
+                        last.emplace(detail::to_qvariant(std::get<std::tuple_size_v<Row>>(r)), rowId(out.back()));
+                    }
+                    return c.status().map([&last] () {
+                        return std::move(last);
+                    });
+                });
+            };
+
+            if (!after)
+                return read(SQL{from_start, std::tuple_cat(filter_binds, std::tuple<long>(limit))});
+            return read(SQL{following, std::tuple_cat(filter_binds, std::tuple<KeyType, long, long>(
+                                detail::from_qvariant<KeyType>::get(after->first), after->second, limit))});
+        };
+    }
+
+    ListModel(Database &db, QObject *parent, PageFn &&fetch_page) :
+        ObjectListModel(makeRoleNames(), parent),
+        db(db),
+        fetch_page(std::move(fetch_page))
+    {}
+
+public:
+    /**
+     * @brief All rows of Self, fetched a page at a time in the order of a single sort key
+     * Pages continue after the sort key and id of the last row fetched, with the id
+     * breaking ties. The key must not be NULL.
+     */
+    template <typename Key, bool Desc>
+    ListModel(Database &db, QObject *parent, Util::ORM::Sel::OrderBy<Key, Desc> order) :
+        ListModel(db, parent, keysetPages(Self::table, Util::ORM::SQL<>(QString()), order))
+    {}
+
+    /**
+     * @brief The rows of Self matching filter, see above
+     */
+    template <Util::ORM::Expr::Expression Filter, typename Key, bool Desc>
+    ListModel(Database &db, QObject *parent, Filter filter, Util::ORM::Sel::OrderBy<Key, Desc> order) :
+        ListModel(db, parent, keysetPages(Self::table, filter.sqlExpression(), order))
+    {}
+
+    /**
+     * @brief Rows of Self from a join, to filter or sort on the other tables
+     * @param source    Self::table or a Sel::Join of it
+     */
+    template <typename Src, typename Filter, typename Key, bool Desc>
+    static ListModel *joined(Database &db, QObject *parent, Src source, Util::ORM::Sel::Where<Filter> where,
+                             Util::ORM::Sel::OrderBy<Key, Desc> order) {
+        return new ListModel(db, parent, keysetPages(source, where.expr.sqlExpression(), order));
+    }
+
+    template <typename Src, typename Key, bool Desc>
+    static ListModel *joined(Database &db, QObject *parent, Src source, Util::ORM::Sel::OrderBy<Key, Desc> order) {
+        return new ListModel(db, parent, keysetPages(source, Util::ORM::SQL<>(QString()), order));
+    }
+
+    /**
+     * @brief Start over with the rows from another query, see joined()
+     * For models whose query changes, e.g. with the text of a search.
+     */
+    template <typename Src, typename Key, bool Desc>
+    void rejoin(Src source, Util::ORM::Sel::OrderBy<Key, Desc> order) {
+        reset(keysetPages(source, Util::ORM::SQL<>(QString()), order));
+    }
+
+    template <typename Src, typename Filter, typename Key, bool Desc>
+    void rejoin(Src source, Util::ORM::Sel::Where<Filter> where, Util::ORM::Sel::OrderBy<Key, Desc> order) {
+        reset(keysetPages(source, where.expr.sqlExpression(), order));
+    }
+
+private:
+    void reset(PageFn &&pages) {
+        beginResetModel();
+        fetch_page = std::move(pages);
+        rows.clear();
+        next_after.reset();
+        at_end = false;
+        generation++;
+        endResetModel();
+    }
+
+    void applyReload(std::vector<Row> &&fresh, Position &&last, bool fresh_at_end) {
+        // Drop rows that don't match anymore
+        QSet<long> ids;
+        for (const Row &row : fresh)
+            ids.insert(rowId(row));
+        for (int i = rows.size() - 1; i >= 0; i--) {
+            if (ids.contains(rowId(rows[i])))
+                continue;
+            beginRemoveRows(QModelIndex(), i, i);
+            rows.erase(rows.begin() + i);
+            endRemoveRows();
+        }
+
+        // Then bring the rest into the new order, rows before i are done
+        for (int i = 0; i < static_cast<int>(fresh.size()); i++) {
+            int j = indexOf(rowId(fresh[i]));
+            if (j < 0) {
+                beginInsertRows(QModelIndex(), i, i);
+                rows.insert(rows.begin() + i, std::move(fresh[i]));
+                endInsertRows();
+                continue;
+            }
+
+            if (j != i) {
+                beginMoveRows(QModelIndex(), j, j, QModelIndex(), i);
+                std::rotate(rows.begin() + i, rows.begin() + j, rows.begin() + j + 1);
+                endMoveRows();
+            }
+            if (rows[i] != fresh[i]) {
+                rows[i] = std::move(fresh[i]);
+                emit dataChanged(index(i), index(i));
+            }
+        }
+
+        next_after = std::move(last);
+        at_end = fresh_at_end;
+    }
+
+public:
+    /**
+     * @brief Run reloads on worker, keeping the query off this thread
+     * The model is updated once the rows are back.
+     */
+    void setWorker(DatabaseWorker *w) {
+        worker = w;
+    }
+
+public:
+
+    // QAbstractListModel
+    virtual int rowCount(const QModelIndex &parent = QModelIndex()) const override {
+        return parent.isValid() ? 0 : rows.size();
+    }
+
+    virtual QVariant data(const QModelIndex &idx, int role = Qt::DisplayRole) const override {
+        if (!idx.isValid() || idx.row() >= static_cast<int>(rows.size()) || role < Qt::UserRole)
+            return QVariant();
+
+        QVariant v;
+        Util::tuple_enumerate_foreach(rows[idx.row()], [&v, col = role - Qt::UserRole] (size_t i, const auto &x) {
+            if (static_cast<int>(i) == col)
+                v = detail::to_qvariant(x);
+        });
+        return v;
+    }
+
+    virtual bool canFetchMore(const QModelIndex &parent) const override {
+        return !parent.isValid() && !at_end;
+    }
+
+    virtual void fetchMore(const QModelIndex &parent) override {
+        if (parent.isValid() || at_end)
+            return;
+
+        std::vector<Row> page;
+        page.reserve(page_size);
+        auto r = fetch_page(db, next_after, page_size, page);
+        if (!r) {
+            qDebug() << "ListModel: fetch failed" << r.error();
+            at_end = true;
+            return;
+        }
+
+        at_end = page.size() < page_size;
+        next_after = std::move(r).value();
+        generation++;
+
+        // Rows whose sort key moved past the position since they were loaded
+        page.erase(std::remove_if(page.begin(), page.end(), [this] (const Row &row) {
+            return indexOf(rowId(row)) >= 0;
+        }), page.end());
+        if (page.empty())
+            return;
+
+        beginInsertRows(QModelIndex(), rows.size(), rows.size() + page.size() - 1);
+        std::move(page.begin(), page.end(), std::back_inserter(rows));
+        endInsertRows();
+    }
+
+    // ObjectListModel
+    virtual QVariant get(int row) override {
+        if (row < 0 || row >= static_cast<int>(rows.size()))
+            return QVariant();
+        return QVariant::fromValue(new Self(db, Row(rows[row])));
+    }
+
+    virtual void refreshRow(long id) override {
+        int i = indexOf(id);
+        if (i < 0)
+            return;
+
+        auto r = loadRow(id);
+        if (!r || !r.value())
+            return;
+
+        rows[i] = std::move(*r.value());
+        emit dataChanged(index(i), index(i));
+    }
+
+    virtual void appendRow(long id) override {
+        // Otherwise it comes with a later page
+        if (!at_end || indexOf(id) >= 0)
+            return;
+
+        auto r = loadRow(id);
+        if (!r || !r.value())
+            return;
+
+        beginInsertRows(QModelIndex(), rows.size(), rows.size());
+        rows.push_back(std::move(*r.value()));
+        endInsertRows();
+        generation++;
+    }
+
+    virtual void dropRow(long id) override {
+        int i = indexOf(id);
+        if (i < 0)
+            return;
+
+        beginRemoveRows(QModelIndex(), i, i);
+        rows.erase(rows.begin() + i);
+        endRemoveRows();
+        generation++;
+    }
+
+    virtual void reload() override {
+        // Nothing fetched, the first page is fresh anyway
+        if (!next_after && !at_end)
+            return;
+
+        size_t limit = std::max(rows.size(), page_size);
+        if (!worker) {
+            std::vector<Row> fresh;
+            auto r = fetch_page(db, std::nullopt, limit, fresh);
+            if (!r) {
+                qDebug() << "ListModel: reload failed" << r.error();
+                return;
+            }
+            bool fresh_at_end = fresh.size() < limit;
+            applyReload(std::move(fresh), std::move(r).value(), fresh_at_end);
+            return;
+        }
+
+        // Changes during a reload need another one, the query may have missed them
+        if (reloading) {
+            reload_again = true;
+            return;
+        }
+        reloading = true;
+
+        using Window = std::pair<std::vector<Row>, Position>;
+        worker->post([pages = fetch_page, limit] (Database &db) -> DBResult<Window> {
+            std::vector<Row> fresh;
+            return pages(db, std::nullopt, limit, fresh).map([&fresh] (Position &&last) {
+                return Window(std::move(fresh), std::move(last));
+            });
+        }, this, [this, limit, started = generation] (DBResult<Window> &&r) {
+            reloading = false;
+            if (!r)
+                qDebug() << "ListModel: reload failed" << r.error();
+            // Rows fetched or dropped meanwhile aren't in the window
+            else if (started != generation)
+                reload_again = true;
+            else {
+                auto &[fresh, last] = r.value();
+                bool fresh_at_end = fresh.size() < limit;
+                applyReload(std::move(fresh), std::move(last), fresh_at_end);
+            }
+
+            if (std::exchange(reload_again, false))
+                reload();
+        });
+    }
+
+    virtual void applyChanges(const QVector<RowChange> &changes, bool inserts) override {
+        if (!inserts) {
+            if (std::any_of(changes.begin(), changes.end(), [this] (const RowChange &c) {
+                    return c.is(Self::table) || m_depends.contains(c.table);
+                }))
+                reload();
+            return;
+        }
+
+        for (const auto &c : changes) {
+            if (!c.is(Self::table))
+                continue;
+
+            switch (c.kind) {
+            case RowChange::Inserted:
+                if (inserts)
+                    appendRow(c.id);
+                break;
+            case RowChange::Updated:
+                refreshRow(c.id);
+                break;
+            case RowChange::Deleted:
+                dropRow(c.id);
+                break;
+            }
+        }
+    }
+};
+
 }
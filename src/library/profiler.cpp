@@ -0,0 +1,94 @@
+#include "profiler.h"
+
+#include <algorithm>
+
+#include <QRegularExpression>
+#include <QTextStream>
+
+
+namespace Midoku::Library {
+
+static QString statement_shape(const QString &sql)
+{
+    // Expr::In binds one placeholder per value
+    static const QRegularExpression in_list(QStringLiteral("\\?(, \\?)+"));
+    QString shape = sql;
+    return shape.replace(in_list, QStringLiteral("?, ..."));
+}
+
+// ---------------
+qint64 QueryProfiler::Stats::percentile(double p) const
+{
+    if (samples.empty())
+        return 0;
+
+    auto sorted = samples;
+    auto n = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+    std::nth_element(sorted.begin(), sorted.begin() + n, sorted.end());
+    return sorted[n];
+}
+
+// ---------------
+void QueryProfiler::setEnabled(bool enabled)
+{
+    this->enabled = enabled;
+}
+
+bool QueryProfiler::record(const Sample &s)
+{
+    auto shape = statement_shape(s.sql);
+    auto &st = statements[shape];
+    if (st.sql.isNull())
+        st.sql = shape;
+
+    st.count++;
+    st.total_ns += s.elapsed_ns;
+    st.max_ns = std::max(st.max_ns, s.elapsed_ns);
+    st.rows += s.row_count;
+
+    if (st.samples.size() < Stats::sample_count) {
+        st.samples.push_back(s.elapsed_ns);
+    } else {
+        st.samples[st.next_sample] = s.elapsed_ns;
+        st.next_sample = (st.next_sample + 1) % Stats::sample_count;
+    }
+
+    return slow_ns > 0 && s.elapsed_ns >= slow_ns && st.plan.isEmpty();
+}
+
+void QueryProfiler::setPlan(const QString &sql, const QStringList &plan)
+{
+    auto it = statements.find(statement_shape(sql));
+    if (it != statements.end())
+        it->plan = plan;
+}
+
+void QueryProfiler::reset()
+{
+    statements.clear();
+}
+
+QString QueryProfiler::report() const
+{
+    auto sorted = statements.values();
+    std::sort(sorted.begin(), sorted.end(), [] (const Stats &a, const Stats &b) {
+        return a.total_ns > b.total_ns;
+    });
+
+    QString r;
+    QTextStream out(&r);
+    for (const auto &st : sorted) {
+        out << QStringLiteral("%1x %2ms total, %3us avg, %4us p99, %5 rows: %6\n")
+               .arg(st.count)
+               .arg(st.total_ns / 1e6, 0, 'f', 2)
+               .arg(st.total_ns / st.count / 1000)
+               .arg(st.percentile(0.99) / 1000)
+               .arg(st.rows)
+               .arg(st.sql);
+        for (const auto &step : st.plan)
+            out << "    " << step << "\n";
+    }
+    return r;
+}
+
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <vector>
+
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QElapsedTimer>
+
+
+namespace Midoku::Library {
+
+/**
+ * @brief Per-statement timing of database queries
+ * Statements are grouped by their SQL text, with IN lists collapsed so that
+ * different list lengths count as the same statement.
+ * Disabled by default; set MIDOKU_SQL_PROFILE in the environment or call
+ * Database::setProfilingEnabled() to turn it on.
+ */
+class QueryProfiler
+{
+public:
+    struct Stats {
+        QString sql;
+        long count = 0;
+        qint64 total_ns = 0;
+        qint64 max_ns = 0;
+        long rows = 0;
+        // EXPLAIN QUERY PLAN, captured the first time the statement was slow
+        QStringList plan;
+
+        // Most recent durations, for percentiles
+        static constexpr size_t sample_count = 256;
+        std::vector<qint64> samples;
+        size_t next_sample = 0;
+
+        qint64 percentile(double p) const;
+    };
+
+    /**
+     * @brief A statement being timed
+     * Cursors keep one open while rows are read, so fetching counts towards the statement.
+     */
+    class Sample
+    {
+        QString sql;
+        QElapsedTimer timer;
+        qint64 elapsed_ns = 0;
+        long row_count = 0;
+
+        friend class QueryProfiler;
+
+    public:
+        explicit Sample(const QString &sql) :
+            sql(sql)
+        {}
+
+        const QString &query() const {
+            return sql;
+        }
+
+        void start() {
+            timer.start();
+        }
+
+        void stop() {
+            elapsed_ns += timer.nsecsElapsed();
+        }
+
+        void addRow() {
+            row_count++;
+        }
+    };
+
+private:
+    bool enabled = false;
+    qint64 slow_ns = 10'000'000;
+    QHash<QString, Stats> statements;
+
+public:
+    bool isEnabled() const {
+        return enabled;
+    }
+
+    void setEnabled(bool enabled);
+
+    /**
+     * @brief Capture the query plan of statements slower than this, 0 to never capture
+     * Defaults to 10ms.
+     */
+    void setSlowThreshold(qint64 ns) {
+        slow_ns = ns;
+    }
+
+    /**
+     * @brief Add a finished sample
+     * @return true if the statement was slow and its plan still needs to be captured
+     */
+    bool record(const Sample &s);
+
+    void setPlan(const QString &sql, const QStringList &plan);
+
+    const QHash<QString, Stats> &stats() const {
+        return statements;
+    }
+
+    void reset();
+
+    /**
+     * @brief Human readable summary, most expensive statements first
+     */
+    QString report() const;
+};
+
+}
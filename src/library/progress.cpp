@@ -1,8 +1,16 @@
 #include "progress.h"
+#include "bookstats.h"
+#include "worker.h"
 
 namespace Midoku::Library {
 DB_OBJECT_IMPL(Progress);
 
+void Progress::recordTriggered(ChangeFeed &feed, const RowChange &change, const Row &row) {
+    // Older progress doesn't move the position, but nobody minds an extra update
+    BookStats::recordUpdate(feed, std::get<Table::column_index<std::decay_t<decltype(book_id)>>()>(row),
+                            BookStats::position, BookStats::last_played, BookStats::state);
+}
+
 QDateTime Progress::timestampDate() const {
     return QDateTime::fromString(get(timestamp), Qt::ISODate);
 }
@@ -43,6 +51,13 @@ DBResult<void> Progress::update(const Chapter &chap, long time) {
     return save().discard();
 }
 
+void Progress::updateAsync(DatabaseWorker &worker, const Chapter &chap, long time) {
+    set(chapter_id, chap.getId());
+    set(Progress::time, time);
+    set(timestamp, QDateTime::currentDateTime().toString(Qt::ISODate));
+    saveAsync(worker);
+}
+
 bool Progress::update(QVariant v) {
     if (v.canConvert<Chapter*>()) {
         return update(*(v.value<Chapter*>()));
@@ -56,7 +71,7 @@ bool Progress::update(QVariant v) {
 DBResult<std::optional<std::unique_ptr<Progress>>> Progress::findMostRecentForBook(Database &db, const Book &b) {
     // TODO: make select<> be able to do this
     using namespace Util::ORM;
-    return Progress::selectOne(db, Progress::book_id == b.getId(), Sel::OrderBy(Expr::datetime(Progress::timestamp), true))
+    return Progress::selectOne(db, Progress::book_id == b.getId(), Sel::OrderBy(Expr::datetime(Progress::timestamp), Sel::Descending))
             .map([] (std::unique_ptr<Progress> p) -> std::optional<std::unique_ptr<Progress>> {
         if (!p)
             return std::nullopt;
@@ -67,13 +82,17 @@ DBResult<std::optional<std::unique_ptr<Progress>>> Progress::findMostRecentForBo
 
 DBResult<std::unique_ptr<Progress>> Progress::findMostRecent(Database &db) {
     using namespace Util::ORM;
-    return Progress::selectOne(db, Sel::OrderBy(Expr::datetime(Progress::timestamp), true));
+    return Progress::selectOne(db, Sel::OrderBy(Expr::datetime(Progress::timestamp), Sel::Descending));
 }
 
 QVariant Book::getMostRecentProgressV() {
-    return Progress::findMostRecentForBook(database(), *this)
-            .map([] (auto opt) {return opt ? QVariant::fromValue(opt.value().release()) : QVariant();})
-            .value_or(QVariant());
+    followChanges();
+    return m_most_recent_progress.get(this, [this] () {
+        return Progress::findMostRecentForBook(database(), *this).map([this] (auto opt) {
+            m_most_recent_progress_id = opt ? opt.value()->getId() : -1;
+            return opt ? QVariant::fromValue(opt.value().release()) : QVariant();
+        });
+    });
 }
 
 DBResult<std::unique_ptr<Progress>> Progress::forBook(Database &db, Book &book) {
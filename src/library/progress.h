@@ -24,7 +24,12 @@ public:
 
     DB_OBJECT(Progress, "Progress", book_id, chapter_id, time, timestamp,
               Util::ORM::ForeignKey(book_id, Util::ORM::References(Book::table, Book::id)),
-              Util::ORM::ForeignKey(chapter_id, Util::ORM::References(Chapter::table, Chapter::id)));
+              Util::ORM::ForeignKey(chapter_id, Util::ORM::References(Chapter::table, Chapter::id)),
+              Util::ORM::Index("book_recent"_T, book_id, Util::ORM::Expr::datetime(timestamp)),
+              Util::ORM::Index("recent"_T, Util::ORM::Expr::datetime(timestamp)));
+
+    // BookStats rows written along with this one, see Object::recordTriggered()
+    static void recordTriggered(ChangeFeed &feed, const RowChange &change, const Row &row);
 
 
     explicit Progress(Database &db, const Chapter &chap, long time, QDateTime when) :
@@ -32,9 +37,13 @@ public:
         row({std::nullopt, chap.get(Chapter::book_id), chap.getId(), time, when.toString(Qt::ISODate)})
     {}
 
-    explicit Progress(Database &db, const QSqlRecord &r) :
+    explicit Progress(Database &db, Row &&data) :
         Object(db),
-        row(qsql_unpack_record<Table>(r))
+        row(std::move(data))
+    {}
+
+    explicit Progress(Database &db, const QSqlQuery &q) :
+        Progress(db, qsql_unpack_query<Table>(q))
     {}
 
     QDateTime timestampDate() const;
@@ -50,6 +59,11 @@ public:
     DBResult<void> update(const Chapter &chap, long time);
     Q_INVOKABLE bool update(QVariant v);
 
+    /**
+     * @brief Like update(chap, time), but written by worker
+     */
+    void updateAsync(DatabaseWorker &worker, const Chapter &chap, long time);
+
     static DBResult<std::optional<std::unique_ptr<Progress>>> findMostRecentForBook(Database &db, const Book &b);
     static DBResult<std::unique_ptr<Progress>> forBook(Database &db, Book &b);
 
@@ -2,6 +2,8 @@
 #include "schema.h"
 #include "models.h"
 #include "progress.h"
+#include "bookstats.h"
+#include "booksearch.h"
 
 #include <QVariant>
 #include <QStringList>
@@ -51,61 +53,112 @@ Library::~Library() {
 }*/
 
 // Schema
+static DBResult<void> exec_all(Database *db, const std::vector<SQL<>> &statements) {
+    DBResult<void> r = Ok();
+    for (const auto &sql : statements) {
+        r = db->exec(sql).discard();
+        if (!r)
+            break;
+    }
+    return r;
+}
+
+template <typename Table>
+static DBResult<void> create_indexes(Database *db, Table) {
+    return exec_all(db, Table::sqlCreateIndexes(true));
+}
+
 DBResult<void> upgrade_schema(Database *db) {
-    static constexpr long top_version = 3;
+    static constexpr long top_version = 6;
 
     auto r = db->exec(SQL<>{"PRAGMA user_version;"}).map([](auto q) {
         return (q.next() ? q.value(0).toInt() : 0);
     }).bind([db](int version) -> DBResult<void> {
-        if (version == 0) {
-            // Create from scratch  q   
-            return Util::tuple_fold_bind(
-                DBResult<void>(Ok()),
-                std::tuple{Blob::table, Book::table, Chapter::table, Progress::table},
-                [db](auto table) {
-                    return db->exec(table.sqlCreateTable(true)).discard();
-                }
-            );
-        } else if (version == top_version)
+        if (version == top_version)
             return Ok();
         else if (version > top_version)
             return Err(QSqlError("", "Unknown DB schema version"));
 
-        // Migration code here.
-        DBResult<void> result = Ok();
-        if (version < 2) {
-            // Add Progress table
-            result = result.bind([db](){
-                return db->exec(Progress::table.sqlCreateTable(true)).discard();
-            });
-        }
-        if (version < 3) {
-            // Add media_offset column to chapter table
-            /*db->qsqldb().transaction();
-            result = result.bind([db]() {
-                return db->exec(QStringLiteral("ALTER TABLE Chapter RENAME TO Mig3_Chapter;")).discard();
-            }).bind([db]() {
-                return db->exec(Chapter::table.sqlCreateTable(false)).discard();
-            }).bind([db]() {
-                static constexpr auto old_cols = std::tuple{Chapter::id, Chapter::book_id, Chapter::chapter, Chapter::length,
-                        Chapter::media, Chapter::media_chapter, Chapter::title, Chapter::cover_blob_id};
-                static const auto cols_string = Util::tuple_map<QStringList>(old_cols, [] (auto &col) {return col.getName();}).join(", ");
-                return db->exec(QStringLiteral("INSERT INTO Chapter (%1) SELECT %1 FROM Mig3_Chapter;").arg(cols_string)).discard();
-            });
-            if (result)
-                db->qsqldb().commit();
-            else
-                db->qsqldb().rollback();*/
-            result = result.bind([db]() {
-                return db->exec(Util::ORM::sql_join(" ", Util::ORM::SQL<>("ALTER TABLE Chapter ADD COLUMN"),
-                                                    Chapter::media_offset.sqlCreateTableColumn(),
-                                                    Util::ORM::SQL<>(";"))).discard();
-            });
-        }
-
-        return result;
-    }).bind([db]() {
-        return db->exec(SQL<>{QStringLiteral("PRAGMA user_version = %0;").arg(top_version)}).discard();
+        // Cached statements may still hold the old schema open
+        db->clearStatementCache();
+
+        auto set_version = [db]() {
+            return db->exec(SQL<>{QStringLiteral("PRAGMA user_version = %0;").arg(top_version)}).discard();
+        };
+
+        // Upgrade all the way or not at all
+        return db->transaction([db, version, set_version]() -> DBResult<void> {
+            if (version == 0) {
+                // Create from scratch
+                return Util::tuple_fold_bind(
+                    DBResult<void>(Ok()),
+                    std::tuple{Blob::table, Book::table, Chapter::table, Progress::table, BookStats::table},
+                    [db](auto table) {
+                        return db->exec(table.sqlCreateTable(true)).bind([db, table](QSqlQuery &&) {
+                            return create_indexes(db, table);
+                        });
+                    }
+                ).bind([db]() {
+                    return exec_all(db, BookStats::sqlCreateTriggers());
+                }).bind([db]() {
+                    return db->exec(BookSearch::sqlCreateTable()).discard();
+                }).bind([db]() {
+                    return exec_all(db, BookSearch::sqlCreateTriggers());
+                }).bind(set_version);
+            }
+
+            // Migration code here.
+            DBResult<void> result = Ok();
+            if (version < 2) {
+                // Add Progress table
+                result = result.bind([db](){
+                    return db->exec(Progress::table.sqlCreateTable(true)).discard();
+                });
+            }
+            if (version < 3) {
+                // Add media_offset column to chapter table
+                result = result.bind([db]() {
+                    return db->exec(Util::ORM::sql_join(" ", Util::ORM::SQL<>("ALTER TABLE Chapter ADD COLUMN"),
+                                                        Chapter::media_offset.sqlCreateTableColumn(),
+                                                        Util::ORM::SQL<>(";"))).discard();
+                });
+            }
+            if (version < 4) {
+                // Add indexes
+                result = Util::tuple_fold_bind(
+                    std::move(result),
+                    std::tuple{Blob::table, Book::table, Chapter::table, Progress::table},
+                    [db](auto table) {
+                        return create_indexes(db, table);
+                    }
+                );
+            }
+
+            if (version < 5) {
+                // Add BookStats table, filled from the existing rows
+                result = result.bind([db]() {
+                    return db->exec(BookStats::table.sqlCreateTable(true)).bind([db](QSqlQuery &&) {
+                        return create_indexes(db, BookStats::table);
+                    });
+                }).bind([db]() {
+                    return exec_all(db, BookStats::sqlCreateTriggers());
+                }).bind([db]() {
+                    return exec_all(db, BookStats::sqlRebuild());
+                });
+            }
+            if (version < 6) {
+                // Add full-text index, filled from the existing rows
+                result = result.bind([db]() {
+                    return db->exec(BookSearch::sqlCreateTable()).discard();
+                }).bind([db]() {
+                    return exec_all(db, BookSearch::sqlCreateTriggers());
+                }).bind([db]() {
+                    return exec_all(db, BookSearch::sqlRebuild());
+                });
+            }
+
+            return result.bind(set_version);
+        });
     });
 
     if (!r)
@@ -114,6 +167,29 @@ DBResult<void> upgrade_schema(Database *db) {
     return r;
 }
 
+DBResult<void> check_query_plans(Database *db) {
+    // Queries that run on startup and on every chapter change
+    auto plans = std::tuple{
+        Progress::table.sqlSelect(Sel::OrderBy(Expr::datetime(Progress::timestamp), Sel::Descending), Sel::Limit(1)),
+        Progress::table.sqlSelect(Sel::Where(Progress::book_id == 1l),
+                                  Sel::OrderBy(Expr::datetime(Progress::timestamp), Sel::Descending), Sel::Limit(1)),
+        Chapter::table.sqlSelect(Sel::Where(Chapter::book_id == 1l), Sel::OrderBy(Chapter::chapter)),
+        Chapter::table.sqlSelect(Sel::Where(Chapter::media == QString())),
+        // Library tabs
+        BookStats::table.sqlSelect(Sel::Where(BookStats::state == long(BookStats::Started)),
+                                   Sel::OrderBy(BookStats::last_played, Sel::Descending)),
+    };
+
+    return Util::tuple_fold_bind(DBResult<void>(Ok()), plans, [db](const auto &sql) {
+        return db->queryPlan(sql).map([&sql](QStringList &&plan) {
+            // Any full table scan or temporary sort means an index is missing or unusable
+            for (const auto &step : plan)
+                if ((step.startsWith("SCAN") && !step.contains("USING")) || step.contains("TEMP B-TREE"))
+                    qWarning() << "Slow query plan:" << sql.query << plan;
+        });
+    });
+}
+
 // Get database object
 /*Database &Library::database() {
     return *db;
@@ -7,4 +7,9 @@ namespace Midoku::Library {
 
 DBResult<void> upgrade_schema(Database *db);
 
+/**
+ * @brief Warn about hot queries that don't use an index
+ */
+DBResult<void> check_query_plans(Database *db);
+
 }
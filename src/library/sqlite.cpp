@@ -0,0 +1,148 @@
+#include "sqlite.h"
+
+#include <dlfcn.h>
+
+#include <algorithm>
+
+#include <QDebug>
+#include <QSqlDriver>
+
+
+namespace Midoku::Library::Sqlite {
+
+// --------------------------------------------------------
+// Statement
+// --------------------------------------------------------
+QSqlError Statement::error() const
+{
+    return conn->lastError();
+}
+
+Result<bool> Statement::step()
+{
+    switch (sqlite3_step(stmt)) {
+    case SQLITE_ROW:
+        return Util::Ok(true);
+    case SQLITE_DONE:
+        return Util::Ok(false);
+    default: {
+        auto err = error();
+        sqlite3_reset(stmt);
+        return Util::Err(std::move(err));
+    }
+    }
+}
+
+Result<void> Statement::exec()
+{
+    Result<bool> r = Util::Ok(true);
+    while (r && r.value())
+        r = step();
+    return r.discard();
+}
+
+void Statement::reset()
+{
+    sqlite3_reset(stmt);
+}
+
+
+// --------------------------------------------------------
+// Connection
+// --------------------------------------------------------
+bool Connection::sharesLibrary(const QSqlDriver *driver)
+{
+    // The driver's vtable lives in the plugin, find out which file that is
+    Dl_info plugin;
+    if (!driver || !dladdr(*reinterpret_cast<void *const *>(driver), &plugin) || !plugin.dli_fname)
+        return false;
+
+    void *lib = dlopen(plugin.dli_fname, RTLD_LAZY | RTLD_NOLOAD);
+    if (!lib)
+        return false;
+
+    // Searches the plugin and its dependencies. A bundled SQLite is either found
+    // in the plugin itself or, with hidden symbols, not at all.
+    void *theirs = dlsym(lib, "sqlite3_open_v2");
+    dlclose(lib);
+
+    return theirs && theirs == reinterpret_cast<void *>(&sqlite3_open_v2);
+}
+
+Connection::Connection(sqlite3 *db) :
+    db(db)
+{}
+
+Connection::~Connection()
+{
+    clearStatementCache();
+}
+
+QSqlError Connection::lastError() const
+{
+    return QSqlError(QStringLiteral("sqlite"),
+                     QString::fromUtf8(sqlite3_errmsg(db)),
+                     QSqlError::StatementError,
+                     QString::number(sqlite3_extended_errcode(db)));
+}
+
+long Connection::lastInsertId() const
+{
+    return static_cast<long>(sqlite3_last_insert_rowid(db));
+}
+
+long Connection::changes() const
+{
+    return sqlite3_changes(db);
+}
+
+Result<Statement> Connection::prepare(const QString &sql)
+{
+    auto it = statement_index.find(sql);
+    if (it != statement_index.end()) {
+        auto &prepared = it.value()->second;
+        // Another Statement may still be stepping it, get a separate one below
+        if (prepared.use_count() == 1) {
+            // Move to front and reset whatever the previous user left behind
+            statements.splice(statements.begin(), statements, it.value());
+            sqlite3_reset(prepared->stmt);
+            sqlite3_clear_bindings(prepared->stmt);
+            return Util::Ok(Statement(this, prepared));
+        }
+    }
+
+    sqlite3_stmt *stmt = nullptr;
+    if (sqlite3_prepare16_v2(db, sql.utf16(), sql.size() * int(sizeof(QChar)), &stmt, nullptr) != SQLITE_OK) {
+        sqlite3_finalize(stmt);
+        return Util::Err(lastError());
+    }
+    auto prepared = std::make_shared<detail::PreparedStatement>(stmt);
+
+    // The cached one stays, this one is finalized after use
+    if (it != statement_index.end())
+        return Util::Ok(Statement(this, std::move(prepared)));
+
+    if (statements.size() >= statement_cache_size) {
+        // Least recently used first, skipping statements in use
+        auto victim = std::find_if(statements.rbegin(), statements.rend(), [] (const auto &entry) {
+            return entry.second.use_count() == 1;
+        });
+        if (victim == statements.rend())
+            return Util::Ok(Statement(this, std::move(prepared)));
+
+        statement_index.remove(victim->first);
+        statements.erase(std::next(victim).base());
+    }
+
+    statements.emplace_front(sql, prepared);
+    statement_index.insert(sql, statements.begin());
+    return Util::Ok(Statement(this, std::move(prepared)));
+}
+
+void Connection::clearStatementCache()
+{
+    statement_index.clear();
+    statements.clear();
+}
+
+} // namespace Midoku::Library::Sqlite
@@ -0,0 +1,266 @@
+#pragma once
+
+#include "../util/result.h"
+#include "../util/orm.h"
+
+#include <list>
+#include <memory>
+#include <optional>
+#include <type_traits>
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QSqlError>
+
+#include <sqlite3.h>
+
+class QSqlDriver;
+
+
+namespace Midoku::Library::Sqlite {
+
+template <typename T>
+using Result = Util::Result<T, QSqlError>;
+
+
+// ========================================================
+// Typed access to sqlite3 values
+// ========================================================
+/**
+ * @brief Type trait describing how T is bound to and read from a statement
+ * Follows the storage classes in ORM::schema_type: INTEGER, TEXT and BLOB
+ */
+template <typename T, typename=void>
+struct native_type;
+
+// INTEGER
+template <typename T>
+struct native_type<T, std::enable_if_t<std::is_integral_v<T>>> {
+    static int bind(sqlite3_stmt *s, int i, T v) {
+        return sqlite3_bind_int64(s, i, static_cast<sqlite3_int64>(v));
+    }
+
+    static T column(sqlite3_stmt *s, int i) {
+        return static_cast<T>(sqlite3_column_int64(s, i));
+    }
+};
+
+// REAL
+template <>
+struct native_type<double> {
+    static int bind(sqlite3_stmt *s, int i, double v) {
+        return sqlite3_bind_double(s, i, v);
+    }
+
+    static double column(sqlite3_stmt *s, int i) {
+        return sqlite3_column_double(s, i);
+    }
+};
+
+// TEXT, null QStrings are NULL
+template <>
+struct native_type<QString> {
+    static int bind(sqlite3_stmt *s, int i, const QString &v) {
+        if (v.isNull())
+            return sqlite3_bind_null(s, i);
+        return sqlite3_bind_text16(s, i, v.utf16(), v.size() * int(sizeof(QChar)), SQLITE_TRANSIENT);
+    }
+
+    static QString column(sqlite3_stmt *s, int i) {
+        auto data = static_cast<const QChar *>(sqlite3_column_text16(s, i));
+        if (!data)
+            return QString();
+        return QString(data, sqlite3_column_bytes16(s, i) / int(sizeof(QChar)));
+    }
+};
+
+// BLOB
+template <>
+struct native_type<QByteArray> {
+    static int bind(sqlite3_stmt *s, int i, const QByteArray &v) {
+        if (v.isNull())
+            return sqlite3_bind_null(s, i);
+        return sqlite3_bind_blob(s, i, v.constData(), v.size(), SQLITE_TRANSIENT);
+    }
+
+    static QByteArray column(sqlite3_stmt *s, int i) {
+        auto data = static_cast<const char *>(sqlite3_column_blob(s, i));
+        if (!data)
+            return QByteArray();
+        return QByteArray(data, sqlite3_column_bytes(s, i));
+    }
+};
+
+// Nullable
+template <typename T>
+struct native_type<std::optional<T>> {
+    static int bind(sqlite3_stmt *s, int i, const std::optional<T> &v) {
+        if (!v)
+            return sqlite3_bind_null(s, i);
+        return native_type<T>::bind(s, i, v.value());
+    }
+
+    static std::optional<T> column(sqlite3_stmt *s, int i) {
+        if (sqlite3_column_type(s, i) == SQLITE_NULL)
+            return std::nullopt;
+        return native_type<T>::column(s, i);
+    }
+};
+
+
+// ========================================================
+// Statements
+// ========================================================
+class Connection;
+
+namespace detail {
+// Finalized once neither the cache nor any Statement refers to it
+struct PreparedStatement {
+    sqlite3_stmt *stmt;
+
+    explicit PreparedStatement(sqlite3_stmt *stmt) :
+        stmt(stmt)
+    {}
+
+    PreparedStatement(const PreparedStatement &) = delete;
+
+    ~PreparedStatement() {
+        sqlite3_finalize(stmt);
+    }
+};
+}
+
+/**
+ * @brief A prepared statement, usually from a Connection's cache
+ * While a Statement exists the cache neither hands it out again nor evicts it.
+ */
+class Statement
+{
+    Connection *conn;
+    std::shared_ptr<detail::PreparedStatement> prepared;
+    sqlite3_stmt *stmt;
+
+    friend class Connection;
+    Statement(Connection *conn, std::shared_ptr<detail::PreparedStatement> prepared) :
+        conn(conn), prepared(std::move(prepared)), stmt(this->prepared->stmt)
+    {}
+
+    QSqlError error() const;
+
+public:
+    // Parameters, starting at 1
+    template <typename T>
+    Result<void> bind(int i, const T &v) {
+        if (native_type<T>::bind(stmt, i, v) != SQLITE_OK)
+            return Util::Err(error());
+        return Util::Ok();
+    }
+
+    template <typename... Ts>
+    Result<void> bindAll(const std::tuple<Ts...> &binds) {
+        Result<void> r = Util::Ok();
+        int i = 1;
+        Util::ORM::sql_foreach_bind_value(binds, [this, &r, &i] (const auto &v) {
+            if (r)
+                r = bind(i++, v);
+        });
+        return r;
+    }
+
+    /**
+     * @return true if a row is available, false when done
+     */
+    Result<bool> step();
+
+    /**
+     * @brief Step until done, for statements that don't return rows
+     */
+    Result<void> exec();
+
+    void reset();
+
+    // Columns, starting at 0
+    template <typename T>
+    T column(int i) const {
+        return native_type<T>::column(stmt, i);
+    }
+
+    /**
+     * @brief Read the current row into a tuple, one column per element
+     */
+    template <typename Tuple>
+    Tuple row() const {
+        return row<Tuple>(std::make_index_sequence<std::tuple_size_v<Tuple>>());
+    }
+
+private:
+    template <typename Tuple, size_t... I>
+    Tuple row(std::index_sequence<I...>) const {
+        return Tuple {
+            column<std::tuple_element_t<I, Tuple>>(static_cast<int>(I))...
+        };
+    }
+};
+
+
+// ========================================================
+// Connection
+// ========================================================
+/**
+ * @brief Native view of an SQLite connection
+ * Doesn't own the sqlite3 handle, which usually belongs to the QSQLITE driver.
+ */
+class Connection
+{
+    sqlite3 *db;
+
+    // LRU cache of prepared statements, most recently used first.
+    // Entries still shared with a Statement are in use.
+    using StatementCache = std::list<std::pair<QString, std::shared_ptr<detail::PreparedStatement>>>;
+    static constexpr size_t statement_cache_size = 64;
+    StatementCache statements;
+    QHash<QString, StatementCache::iterator> statement_index;
+
+    friend class Statement;
+
+public:
+    explicit Connection(sqlite3 *db);
+    ~Connection();
+
+    Connection(const Connection &) = delete;
+
+    /**
+     * @brief Whether driver calls into the same SQLite library as this program
+     * Only then can its sqlite3 handle be used here. Qt's plugin may just as well
+     * carry its own copy of SQLite, two copies on one handle are undefined behaviour.
+     */
+    static bool sharesLibrary(const QSqlDriver *driver);
+
+    sqlite3 *handle() const {
+        return db;
+    }
+
+    QSqlError lastError() const;
+    long lastInsertId() const;
+    long changes() const;
+
+    /**
+     * @brief A statement for sql, from the cache unless that one is in use
+     */
+    Result<Statement> prepare(const QString &sql);
+    /**
+     * @brief Drop all cached statements, those in use are finalized once released
+     */
+    void clearStatementCache();
+
+    // Convenience
+    template <typename... Ts>
+    Result<Statement> prepare(const Util::ORM::SQL<Ts...> &sql) {
+        return prepare(sql.query).bind([&sql] (Statement &&s) {
+            return s.bindAll(sql.binds).map([&s] () {return std::move(s);});
+        });
+    }
+};
+
+} // namespace Midoku::Library::Sqlite
@@ -0,0 +1,32 @@
+#include "worker.h"
+
+
+namespace Midoku::Library {
+
+DatabaseWorker::DatabaseWorker(const QString &path) :
+    executor(new QObject())
+{
+    thread.setObjectName(QStringLiteral("DatabaseWorker"));
+    executor->moveToThread(&thread);
+    thread.start();
+
+    // QtSql connections may only be used from the thread that opened them
+    QMetaObject::invokeMethod(executor, [this, path] () {
+        db = std::make_unique<Database>(path, QStringLiteral("worker:") + path);
+        QObject::connect(&db->changes(), &ChangeFeed::rowsChanged, &feed, &ChangeFeed::rowsChanged);
+    }, Qt::QueuedConnection);
+}
+
+DatabaseWorker::~DatabaseWorker()
+{
+    // Quit after the jobs queued before this one
+    QMetaObject::invokeMethod(executor, [this] () {
+        db.reset();
+        thread.quit();
+    }, Qt::QueuedConnection);
+
+    thread.wait();
+    delete executor;
+}
+
+}
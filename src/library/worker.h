@@ -0,0 +1,150 @@
+#pragma once
+
+#include "database.h"
+
+#include <coroutine>
+#include <functional>
+#include <memory>
+#include <optional>
+
+#include <QObject>
+#include <QPointer>
+#include <QThread>
+
+
+namespace Midoku::Library {
+
+/**
+ * @brief Runs database jobs on a dedicated thread with its own connection
+ * Jobs run one at a time in the order they were posted. They get the worker's
+ * Database, which must not escape the job: return rows or plain values, not
+ * objects loaded from it.
+ */
+class DatabaseWorker
+{
+    QThread thread;
+    // Lives in thread, jobs are queued to it
+    QObject *executor;
+    // Only touched from thread
+    std::unique_ptr<Database> db;
+    // Lives in the creating thread, forwards db's feed
+    ChangeFeed feed;
+    // Lives in the creating thread, job results are queued to it
+    QObject replies;
+
+public:
+    explicit DatabaseWorker(const QString &path);
+    ~DatabaseWorker();
+
+    DatabaseWorker(const DatabaseWorker &) = delete;
+
+    /**
+     * @brief Rows written by jobs, published in the thread that created the worker
+     */
+    ChangeFeed &changes() {
+        return feed;
+    }
+
+    /**
+     * @brief Run job(Database &) on the worker thread
+     * callback receives the job's DBResult in the thread that created the worker,
+     * which context must live in. It is dropped if context is destroyed first.
+     */
+    template <typename F, typename Cb>
+    void post(F &&job, QObject *context, Cb &&callback) {
+        Q_ASSERT(context->thread() == replies.thread());
+        QMetaObject::invokeMethod(executor, [this, job = std::forward<F>(job), context = QPointer<QObject>(context),
+                                             callback = std::forward<Cb>(callback)] () mutable {
+            auto r = std::invoke(job, *db);
+            // context may only be looked at from its own thread
+            QMetaObject::invokeMethod(&replies, [context = std::move(context), callback = std::move(callback),
+                                                 r = std::move(r)] () mutable {
+                if (context)
+                    std::invoke(callback, std::move(r));
+            }, Qt::QueuedConnection);
+        }, Qt::QueuedConnection);
+    }
+
+    /**
+     * @brief Awaitable job(Database &)
+     * The awaiting coroutine resumes with the job's DBResult in context's thread.
+     * It is never resumed if context is destroyed first.
+     */
+    template <typename F>
+    auto run(F &&job, QObject *context) {
+        using R = std::invoke_result_t<F, Database &>;
+        struct Awaiter {
+            DatabaseWorker *worker;
+            std::decay_t<F> job;
+            QObject *context;
+            std::optional<R> result;
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> h) {
+                // The awaiter lives in the suspended coroutine's frame
+                worker->post(std::move(job), context, [this, h] (R &&r) {
+                    result.emplace(std::move(r));
+                    h.resume();
+                });
+            }
+
+            R await_resume() {
+                return std::move(*result);
+            }
+        };
+        return Awaiter{this, std::forward<F>(job), context, std::nullopt};
+    }
+
+    /**
+     * @brief Run job(Database &) on the worker thread, only logging errors
+     */
+    template <typename F>
+    void post(F &&job) {
+        QMetaObject::invokeMethod(executor, [this, job = std::forward<F>(job)] () mutable {
+            auto r = std::invoke(job, *db);
+            if (!r)
+                qWarning() << "Database worker:" << r.error();
+        }, Qt::QueuedConnection);
+    }
+};
+
+
+template <typename Self>
+void Object<Self>::saveAsync(DatabaseWorker &worker) {
+    long id = getId();
+    if (id <= 0) {
+        // Inserting here hands out the row ID, the worker couldn't tell us
+        auto r = save();
+        if (!r)
+            qWarning() << "Could not save" << Util::ORM::tstring_qstring(Self::Table::name) << r.error();
+        return;
+    }
+
+    auto &row = static_cast<Self*>(this)->row;
+    auto dirty = row.get_dirty();
+    auto data = row.get();
+    row.reset_dirty();
+    database().template uncacheRow<typename Self::Table>(id);
+
+    worker.post([data = std::move(data), dirty] (Database &db) mutable {
+        Self o(db, std::move(data));
+        o.row.set_dirty(dirty);
+        return o.save().discard();
+    }, this, [this, dirty] (DBResult<void> &&r) {
+        if (r)
+            return;
+        qWarning() << "Could not save" << Util::ORM::tstring_qstring(Self::Table::name) << r.error();
+
+        // Written again by the next save, along with whatever changed since
+        auto &row = static_cast<Self*>(this)->row;
+        auto flags = row.get_dirty();
+        for (size_t i = 0; i < flags.size(); i++)
+            flags[i] = flags[i] || dirty[i];
+        row.set_dirty(flags);
+    });
+}
+
+}
@@ -2,6 +2,8 @@
 
 #include "error.h"
 #include "library/blob.h"
+#include "library/booksearch.h"
+#include "library/bookstats.h"
 #include "library/progress.h"
 #include "mpris.h"
 
@@ -12,7 +14,8 @@
 namespace Midoku {
 
 QmlBlobImageProvider::QmlBlobImageProvider(Library::Database *db) :
-    QQuickImageProvider(QQuickImageProvider::Image),
+    // Decode covers off the GUI thread, see Database::reader()
+    QQuickImageProvider(QQuickImageProvider::Image, QQmlImageProviderBase::ForceAsynchronousImageLoading),
     db(db)
 {}
 
@@ -23,7 +26,7 @@ QImage QmlBlobImageProvider::requestImage(const QString &id, QSize *size, const
 
     qDebug() << "Image from Blob:" << blob_id;
 
-    QImage img = db->load<Library::Blob>(blob_id).map([] (auto blob) {
+    QImage img = db->reader().load<Library::Blob>(blob_id).map([] (auto blob) {
         return blob->toImage();
     }).value_or(QImage());
 
@@ -35,11 +38,21 @@ QImage QmlBlobImageProvider::requestImage(const QString &id, QSize *size, const
         return img;
 }
 
-App::App(Library::Database *db) :
+App::App(Library::Database *db, Library::DatabaseWorker *worker) :
     QObject(),
     m_player(this),
-    mp_db(db)
+    mp_db(db),
+    mp_worker(worker)
 {
+    m_player.setDatabase(db, worker);
+
+    // Rows written by the worker may be cached here
+    connect(&worker->changes(), &Library::ChangeFeed::rowsChanged, db, [db] (const QVector<Library::RowChange> &changes) {
+        db->uncacheRows(changes);
+    });
+    // Then let objects and models of this connection see them too
+    connect(&worker->changes(), &Library::ChangeFeed::rowsChanged, &db->changes(), &Library::ChangeFeed::rowsChanged);
+
     // D-Bus
     new Mpris::MediaPlayer2Adaptor(&m_player);
     new Mpris::PlayerAdaptor(&m_player);
@@ -75,16 +88,20 @@ bool App::seekChapter(long time) {
     return true;
 }
 
+// These only report whether the action was started
 bool App::seekRelative(long diff) {
-    return m_player.seekRelative(diff);
+    m_player.seekRelative(diff).detach(log_error<void>);
+    return true;
 }
 
 bool App::nextChapter() {
-    return m_player.nextChapter().value_or(false);
+    m_player.nextChapter().detach(log_error<bool>);
+    return true;
 }
 
 bool App::previousChapter() {
-    return m_player.previousChapter().value_or(false);
+    m_player.previousChapter().detach(log_error<bool>);
+    return true;
 }
 
 bool App::loadRecentBook() {
@@ -97,11 +114,72 @@ bool App::loadRecentBook() {
 
 
 QVariant App::booksModel() {
-    auto model = new Library::TableModel(nullptr, mp_db->qsqldb(), Library::Book::table);
-    if(!model->select())
-        qDebug() << "Select error" << model->lastError();
-    qDebug() << "Model:" << model->tableName() << model->rowCount();
+    using namespace Util::ORM;
+    if (!mp_books_model) {
+        mp_books_model = new Library::ListModel<Library::Book>(*mp_db, this, Sel::OrderBy(Library::Book::id));
+        mp_books_model->follow(mp_db->changes());
+    }
+    return QVariant::fromValue(mp_books_model);
+}
+
+QVariant App::booksModel(int state) {
+    using namespace Util::ORM;
+    using Library::Book;
+    using Library::BookStats;
+    if (state < 0 || state >= static_cast<int>(m_books_by_state.size()))
+        return QVariant();
+
+    auto &model = m_books_by_state[state];
+    if (model)
+        return QVariant::fromValue(model);
+
+    auto books = Book::table.join(BookStats::table, BookStats::table[BookStats::id] == Book::table[Book::id]);
+    auto where = Sel::Where(BookStats::table[BookStats::state] == long(state));
+
+    Library::ListModel<Book> *m;
+    if (state == BookStats::New)
+        m = Library::ListModel<Book>::joined(*mp_db, this, books, where, Sel::OrderBy(Book::table[Book::id]));
+    else
+        m = Library::ListModel<Book>::joined(*mp_db, this, books, where,
+                                             Sel::OrderBy(BookStats::table[BookStats::last_played], Sel::Descending));
+    // Playing saves progress every minute, keep the reloads off the GUI thread
+    m->setWorker(mp_worker);
+    // Progress and chapters move books between states, see Object::recordTriggered()
+    m->follow(mp_db->changes(), false, {BookStats::table.getName()});
+    model = m;
     return QVariant::fromValue(model);
 }
 
+QVariant App::searchModel() {
+    using namespace Util::ORM;
+    using Library::Book;
+    using Library::Chapter;
+    if (!mp_search_model) {
+        // All books until there is something to search for
+        mp_search_model = Library::ListModel<Book>::joined(*mp_db, this, Book::table, Sel::OrderBy(Book::table[Book::id]));
+        mp_search_model->setWorker(mp_worker);
+        // Chapter titles are searched too
+        mp_search_model->follow(mp_db->changes(), false, {Chapter::table.getName()});
+    }
+    return QVariant::fromValue(static_cast<Library::ObjectListModel *>(mp_search_model));
+}
+
+void App::setSearchQuery(const QString &text) {
+    using namespace Util::ORM;
+    using Library::Book;
+    using Library::BookSearch;
+
+    // Created on first use
+    searchModel();
+    auto query = BookSearch::matchQuery(text);
+    if (query.isEmpty()) {
+        mp_search_model->rejoin(Book::table, Sel::OrderBy(Book::table[Book::id]));
+        return;
+    }
+
+    auto books = Book::table.join(BookSearch::table, BookSearch::table[BookSearch::rowid] == Book::table[Book::id]);
+    mp_search_model->rejoin(books, Sel::Where(BookSearch::table.ref().match(query)),
+                            Sel::OrderBy(Expr::bm25(BookSearch::table.ref())));
+}
+
 }
@@ -4,6 +4,8 @@
 #include "../library/book.h"
 #include "../library/models.h"
 
+#include <array>
+
 #include <QObject>
 #include <QQuickImageProvider>
 
@@ -26,11 +28,19 @@ class App : public QObject
 
     Player m_player;
     Library::Database *mp_db;
+    Library::DatabaseWorker *mp_worker;
+
+    // Handed to QML, created on first use and owned by the App
+    Library::ObjectListModel *mp_books_model = nullptr;
+    std::array<Library::ObjectListModel *, 3> m_books_by_state {};
+    Library::ListModel<Library::Book> *mp_search_model = nullptr;
 
     Q_PROPERTY(Player *player READ player);
+    // Books matching the words of setSearchQuery(), best matches first
+    Q_PROPERTY(QVariant searchModel READ searchModel CONSTANT);
 
 public:
-    explicit App(Library::Database *db);
+    App(Library::Database *db, Library::DatabaseWorker *worker);
 
     inline Player *player() {
         return &m_player;
@@ -45,6 +55,10 @@ public:
     bool loadRecentBook();
 
     Q_INVOKABLE QVariant booksModel();
+    // Books in a BookStats::State, most recently played first
+    Q_INVOKABLE QVariant booksModel(int state);
+    QVariant searchModel();
+    Q_INVOKABLE void setSearchQuery(const QString &text);
 
 signals:
     void bookChanged();
@@ -36,4 +36,11 @@ public:
 template <typename R>
 using Result = Util::Result<R, Error>;
 
+// For results nobody waits for, e.g. of detached Tasks
+template <typename T>
+inline void log_error(Result<T> &&r) {
+    if (!r)
+        r.error().debugPrint();
+}
+
 }
@@ -148,11 +148,11 @@ bool PlayerAdaptor::CanControl() {
 
 // Methods
 void PlayerAdaptor::Next() {
-    player->nextChapter();
+    player->nextChapter().detach(log_error<bool>);
 }
 
 void PlayerAdaptor::Previous() {
-    player->previousChapter();
+    player->previousChapter().detach(log_error<bool>);
 }
 
 void PlayerAdaptor::Pause() {
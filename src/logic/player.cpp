@@ -18,24 +18,41 @@ Player::Player(QObject *parent) :
     //connect(&mpv, &Mpv::pauseChanged, this, &Player::pauseChanged);
     connect(&mpv, &Mpv::pauseChanged, this, &Player::onPause);
     connect(this, &Player::chapterChanged, this, &Player::chapterDurationChanged);
-    connect(&mpv, &Mpv::endOfFile, this, &Player::nextChapter);
+    connect(&mpv, &Mpv::endOfFile, this, [this] () {
+        nextChapter().detach(log_error<bool>);
+    });
     connect(&update_timer, &QTimer::timeout, this, &Player::updateProgress);
     update_timer.setInterval(60000); // 1/min
 }
 
+void Player::setDatabase(Database *db, DatabaseWorker *worker) {
+    mp_db = db;
+    mp_worker = worker;
+}
+
 void Player::updateTime() {
     chapter_time = mpv.time() - chapter_media_offset;
     book_time = chapter_time_offset + chapter_time;
 
-    if (chapter_time > chapter_duration) {
-        // update chapter info
-        mp_chapter->getNextChapter().map([this](auto chp) -> void {
-            if (!chp)
+    if (chapter_time > chapter_duration && !chapter_lookup_pending) {
+        // update chapter info, off the GUI thread since this runs on every time update
+        chapter_lookup_pending = true;
+        long chapter_id = mp_chapter->getId();
+        mp_worker->post([book = mp_chapter->get(Chapter::book_id), chap = mp_chapter->get(Chapter::chapter)] (Database &db) {
+            return Chapter::findNextRow(db, book, chap);
+        }, this, [this, chapter_id] (DBResult<std::optional<Chapter::Row>> &&r) {
+            chapter_lookup_pending = false;
+            if (!r) {
+                qDebug() << "Player: Failed to find next chapter" << r.error();
+                return;
+            }
+            // Chapter changed in the meantime
+            if (!r.value() || !mp_chapter || mp_chapter->getId() != chapter_id)
                 return;
 
             chapter_time_offset += chapter_duration;
             chapter_time -= chapter_duration;
-            mp_chapter = std::move(*chp);
+            mp_chapter = std::make_unique<Chapter>(*mp_db, std::move(*r.value()));
             chapter_media_offset = mp_chapter->get(Chapter::media_offset).value_or(0);
             chapter_duration = mp_chapter->get(Chapter::length);
             emit chapterChanged(mp_chapter.get());
@@ -45,11 +62,8 @@ void Player::updateTime() {
 }
 
 void Player::updateProgress() {
-    if (mp_progress) {
-        auto r = mp_progress->update(*mp_chapter, chapter_time);
-        if (!r)
-            qDebug() << "Progress: Failed" << r.error();
-    }
+    if (mp_progress)
+        mp_progress->updateAsync(*mp_worker, *mp_chapter, chapter_time);
 }
 
 void Player::onPause(bool paused) {
@@ -133,52 +147,56 @@ void Player::seekChapter(qint64 time) {
     emit seeked();
 }
 
-Result<void> Player::seekRelative(qint64 diff) {
-    auto time = mpv.time();
-    auto target = time + diff - chapter_media_offset;
-    long offset = 0;
-    return ([this, target](long &offset) -> DBResult<std::optional<ChapterPtr>> {
-        // See if we cross chapter boundaries
-        if (target < 0) {
-            offset = target;
-            return mp_chapter->getPreviousChapter();
-        } else if (target > chapter_duration) {
-            offset = target - chapter_duration;
-            return mp_chapter->getNextChapter();
-        } else {
-            offset = target;
-            return Ok(std::nullopt);
-        }
-    })(offset).bind([this, offset](std::optional<ChapterPtr> c) -> Result<void> {
-        if (c) {
-            return playChapter(std::move(c.value()), offset);
-        } else if (offset != 0) {
-            // Same chapter
-            mpv.set_time(offset + chapter_media_offset);
-            emit seeked();
-            return Ok();
-        } else {
-            // End
-            // FIXME: signal end of book
-            return Ok();
-        }
-    });
+Task<Result<std::optional<ChapterPtr>>> Player::findAdjacentChapter(bool next) {
+    auto book = mp_chapter->get(Chapter::book_id);
+    auto chap = mp_chapter->get(Chapter::chapter);
+    auto lookup = [book, chap, next] (Database &db) {
+        return next ? Chapter::findNextRow(db, book, chap) : Chapter::findPreviousRow(db, book, chap);
+    };
+    auto r = co_await mp_worker->run(std::move(lookup), this);
+    auto row = co_await std::move(r);
+
+    if (!row)
+        co_return Ok(std::optional<ChapterPtr>());
+    co_return Ok(std::optional<ChapterPtr>(std::make_unique<Chapter>(*mp_db, std::move(*row))));
 }
 
-Result<bool> Player::nextChapter() {
-    return mp_chapter->getNextChapter().bind([this](std::optional<ChapterPtr> c) -> Result<bool> {
-        if (c)
-            return playChapter(std::move(c.value())).map([]{return true;});
-        return Ok(false);
-    });
+Task<Result<void>> Player::seekRelative(qint64 diff) {
+    auto target = mpv.time() + diff - chapter_media_offset;
+    if (target >= 0 && target <= chapter_duration) {
+        // Same chapter
+        mpv.set_time(target + chapter_media_offset);
+        emit seeked();
+        co_return Ok();
+    }
+
+    // Crossing chapter boundaries, negative offsets count from the end
+    bool next = target > chapter_duration;
+    long offset = next ? target - chapter_duration : target;
+    auto r = co_await findAdjacentChapter(next);
+    auto c = co_await std::move(r);
+    if (c)
+        co_await playChapter(std::move(*c), offset);
+    // FIXME: signal end of book
+    co_return Ok();
 }
 
-Result<bool> Player::previousChapter() {
-    return mp_chapter->getPreviousChapter().bind([this](std::optional<ChapterPtr> c) -> Result<bool> {
-        if (c)
-            return playChapter(std::move(c.value())).map([]{return true;});
-        return Ok(false);
-    });
+Task<Result<bool>> Player::nextChapter() {
+    auto r = co_await findAdjacentChapter(true);
+    auto c = co_await std::move(r);
+    if (!c)
+        co_return Ok(false);
+    co_await playChapter(std::move(*c));
+    co_return Ok(true);
+}
+
+Task<Result<bool>> Player::previousChapter() {
+    auto r = co_await findAdjacentChapter(false);
+    auto c = co_await std::move(r);
+    if (!c)
+        co_return Ok(false);
+    co_await playChapter(std::move(*c));
+    co_return Ok(true);
 }
 
 }
@@ -3,7 +3,9 @@
 #include "library/book.h"
 #include "library/chapter.h"
 #include "library/progress.h"
+#include "library/worker.h"
 #include "mpv/mpv.h"
+#include "util/task.h"
 #include "error.h"
 
 #include <QObject>
@@ -20,6 +22,11 @@ class Player : public QObject
 
     QTimer update_timer;
 
+    Library::Database *mp_db = nullptr;
+    // Progress saves and chapter lookups during playback run here
+    Library::DatabaseWorker *mp_worker = nullptr;
+    bool chapter_lookup_pending = false;
+
     Library::BookPtr mp_book;
     Library::ChapterPtr mp_chapter;
     Library::ProgressPtr mp_progress;
@@ -43,12 +50,17 @@ class Player : public QObject
     void updateProgress();
     void onPause(bool);
 
+    // Look up the chapter after or before the current one on the worker
+    Util::Task<Result<std::optional<Library::ChapterPtr>>> findAdjacentChapter(bool next);
+
     Q_PROPERTY(Mpv *mpv READ getMpv)
     //Q_PROPERTY(bool pause READ pause WRITE pause NOTIFY pauseChanged)
 
 public:
     Player(QObject *parent);
 
+    void setDatabase(Library::Database *db, Library::DatabaseWorker *worker);
+
     // Properties
     inline Mpv *getMpv() {
         return &mpv;
@@ -94,9 +106,10 @@ public:
     Result<void> playChapter(Library::ChapterPtr &&chap, long start_time=0, bool start=true);
     Result<void> playResume(Library::ProgressPtr &&prog, bool start=true);
     void seekChapter(qint64 time);
-    Result<void> seekRelative(qint64 time);
-    Result<bool> nextChapter();
-    Result<bool> previousChapter();
+    // These finish once the chapter has been looked up
+    Util::Task<Result<void>> seekRelative(qint64 time);
+    Util::Task<Result<bool>> nextChapter();
+    Util::Task<Result<bool>> previousChapter();
 
 signals:
     void timeChanged();
@@ -12,6 +12,7 @@
 #include "library/schema.h"
 #include "library/models.h"
 #include "library/importer.h"
+#include "library/worker.h"
 #include "logic/app.h"
 #include "settings.h"
 
@@ -69,6 +70,14 @@ int main(int argc, char *argv[]) {
         qDebug() << "Schema Version:" << q.value(0).toInt();
     }
 
+#ifndef NDEBUG
+    {
+        auto res = check_query_plans(&db);
+        if (!res)
+            qDebug() << "Query plan check failed:" << res.error();
+    }
+#endif
+
     {
         Importer i (db);
         QProgressDialog dlg;
@@ -132,7 +141,10 @@ int main(int argc, char *argv[]) {
     }
 #endif
 
-    Midoku::App app(&db);
+    // Writes during playback, after the schema is up to date
+    DatabaseWorker worker(appdata + "/test.db");
+
+    Midoku::App app(&db, &worker);
     app.loadRecentBook();
 
     QQmlApplicationEngine engine;
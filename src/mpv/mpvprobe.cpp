@@ -0,0 +1,176 @@
+#include "mpvprobe.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <utility>
+
+#include <QDebug>
+
+
+// --------------------------------------------------------
+// MpvProbePool implementation
+// --------------------------------------------------------
+MpvProbePool::MpvProbePool(size_t size, std::chrono::milliseconds timeout) :
+    timeout(timeout)
+{
+    if (size == 0)
+        size = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 4);
+
+    handles.reserve(size);
+    for (size_t i = 0; i < size; i++) {
+        auto r = create_handle();
+        if (!r) {
+            qWarning() << "MpvProbe:" << r.error();
+            break;
+        }
+        handles.push_back(r.value());
+    }
+}
+
+MpvProbePool::~MpvProbePool()
+{
+    for (auto mpv : handles)
+        if (mpv)
+            mpv_terminate_destroy(mpv);
+}
+
+Midoku::Util::Result<mpv_handle *, QString> MpvProbePool::create_handle()
+{
+    using Midoku::Util::Ok;
+    using Midoku::Util::Err;
+
+    mpv_handle *mpv = mpv_create();
+    if (!mpv)
+        return Err(QStringLiteral("Could not create mpv probe context"));
+
+    // Demux only: null outputs, paused, no video or subtitles, nothing user-configured
+    static constexpr std::pair<const char *, const char *> options[] = {
+        {"config", "no"},
+        {"terminal", "no"},
+        {"load-scripts", "no"},
+        {"ytdl", "no"},
+        {"input-default-bindings", "no"},
+        {"idle", "yes"},
+        {"pause", "yes"},
+        {"vo", "null"},
+        {"ao", "null"},
+        {"vid", "no"},
+        {"sid", "no"},
+        {"audio-display", "no"},
+        {"cache", "no"},
+    };
+
+    for (auto [name, value] : options)
+        if (mpv_set_option_string(mpv, name, value) < 0)
+            qWarning() << "MpvProbe: Could not set option" << name;
+
+    if (mpv_initialize(mpv) < 0) {
+        mpv_terminate_destroy(mpv);
+        return Err(QStringLiteral("Could not initialize mpv probe context"));
+    }
+
+    return Ok(std::move(mpv));
+}
+
+std::optional<MpvProbeResult> MpvProbePool::probe_one(mpv_handle *mpv, const std::filesystem::path &file,
+                                                      std::chrono::milliseconds timeout, bool &timed_out)
+{
+    using clock = std::chrono::steady_clock;
+
+    const char *load[] = {"loadfile", file.c_str(), "replace", nullptr};
+    if (mpv_command(mpv, load) < 0)
+        return std::nullopt;
+
+    // Events belonging to a previous file may still be queued, so wait for our START_FILE first
+    auto deadline = clock::now() + timeout;
+    bool started = false;
+    bool loaded = false;
+    timed_out = false;
+
+    while (!loaded) {
+        auto left = std::chrono::duration<double>(deadline - clock::now()).count();
+        if (left <= 0) {
+            timed_out = true;
+            qWarning() << "MpvProbe: Timed out on" << file.c_str();
+            return std::nullopt;
+        }
+
+        mpv_event *e = mpv_wait_event(mpv, left);
+        if (e->event_id == MPV_EVENT_START_FILE)
+            started = true;
+        else if (started && e->event_id == MPV_EVENT_FILE_LOADED)
+            loaded = true;
+        else if (started && e->event_id == MPV_EVENT_END_FILE) {
+            qWarning() << "MpvProbe: mpv could not open" << file.c_str();
+            return std::nullopt;
+        }
+    }
+
+    MpvProbeResult r;
+    r.duration = mpv_type::property<double>::get(mpv, "duration").value_or(0);
+
+    auto chapter_count = mpv_type::property<qint64>::get(mpv, "chapter-list/count").value_or(0);
+    r.chapters.reserve(chapter_count);
+    for (qint64 i = 0; i < chapter_count; i++) {
+        auto prefix = QStringLiteral("chapter-list/%1/").arg(i);
+        r.chapters.push_back(MpvProbeChapter{
+            mpv_type::property<double>::get(mpv, (prefix + "time").toUtf8().constData()).value_or(0),
+            mpv_type::property<QString>::get(mpv, (prefix + "title").toUtf8().constData()).value_or(QString())
+        });
+    }
+
+    auto tag = [mpv](const char *name) {
+        return mpv_type::property<QString>::get(mpv, name).value_or(QString());
+    };
+    r.title    = tag("metadata/by-key/title");
+    r.album    = tag("metadata/by-key/album");
+    r.artist   = tag("metadata/by-key/artist");
+    r.composer = tag("metadata/by-key/composer");
+    r.track    = tag("metadata/by-key/track");
+    r.disc     = tag("metadata/by-key/disc");
+
+    const char *stop[] = {"stop", nullptr};
+    mpv_command(mpv, stop);
+
+    return r;
+}
+
+std::vector<std::optional<MpvProbeResult>> MpvProbePool::probe(const std::vector<std::filesystem::path> &files)
+{
+    std::vector<std::optional<MpvProbeResult>> results(files.size());
+    std::atomic<size_t> next = 0;
+
+    std::vector<std::thread> workers;
+    workers.reserve(handles.size());
+
+    for (auto &handle : handles) {
+        if (!handle)
+            continue;
+        workers.emplace_back([this, &handle, &files, &results, &next] {
+            for (size_t i = next++; i < files.size(); i = next++) {
+                bool timed_out;
+                results[i] = probe_one(handle, files[i], timeout, timed_out);
+
+                // A context stuck in a demuxer cannot be trusted with the next file.
+                // Destroying it waits for the demuxer, which may never return.
+                if (timed_out) {
+                    std::thread([mpv = std::exchange(handle, nullptr)] {
+                        mpv_terminate_destroy(mpv);
+                    }).detach();
+                    auto r = create_handle();
+                    if (!r) {
+                        qWarning() << "MpvProbe:" << r.error();
+                        return;
+                    }
+                    handle = r.value();
+                }
+            }
+        });
+    }
+
+    for (auto &worker : workers)
+        worker.join();
+
+    return results;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+#include <QString>
+
+#include "mpv_type.h"
+#include "../util/result.h"
+
+
+// ========================================================
+// Headless MPV media probing
+// ========================================================
+struct MpvProbeChapter {
+    double time;
+    QString title;
+};
+
+struct MpvProbeResult {
+    double duration = 0;
+    std::vector<MpvProbeChapter> chapters;
+    QString title;
+    QString album;
+    QString artist;
+    QString composer;
+    QString track;
+    QString disc;
+};
+
+/**
+ * @brief Pool of mpv contexts that only demux files to read their metadata
+ * Audio and video go to null outputs and playback stays paused, so next to nothing is decoded.
+ * The audio track stays selected: with no stream selected at all mpv ends the file
+ * before it is loaded.
+ * Each context is driven by its own worker thread while probing. A context that times out
+ * is replaced, the old one is destroyed on a detached thread.
+ */
+class MpvProbePool
+{
+    std::vector<mpv_handle *> handles;
+    std::chrono::milliseconds timeout;
+
+    static Midoku::Util::Result<mpv_handle *, QString> create_handle();
+    static std::optional<MpvProbeResult> probe_one(mpv_handle *mpv, const std::filesystem::path &file,
+                                                   std::chrono::milliseconds timeout, bool &timed_out);
+
+public:
+    /**
+     * Contexts that fail to initialize are left out, without any probe() fails every file.
+     * @param size      Number of mpv contexts, 0 picks one per core up to 4
+     * @param timeout   Maximum time spent on a single file
+     */
+    MpvProbePool(size_t size = 0, std::chrono::milliseconds timeout = std::chrono::seconds(5));
+    ~MpvProbePool();
+
+    MpvProbePool(const MpvProbePool &) = delete;
+
+    /**
+     * @brief Probe files in parallel
+     * @return One entry per file, std::nullopt where mpv failed or timed out
+     */
+    std::vector<std::optional<MpvProbeResult>> probe(const std::vector<std::filesystem::path> &files);
+};
@@ -8,12 +8,62 @@ import org.kde.kirigami 2.4 as Kirigami
 Kirigami.Page {
     id: libraryPage
 
+    Component {
+        id: bookDelegate
+
+        Kirigami.BasicListItem {
+            reserveSpaceForIcon: false
+            label: model.title
+
+            onClicked: {
+                mainPage.playBook(model.id)
+                root.pageStack.pop()
+            }
+        }
+    }
+
+    TextField {
+        id: searchField
+
+        anchors.top: parent.top
+        width: parent.width
+
+        placeholderText: "Search"
+
+        onTextChanged: searchTimer.restart()
+    }
+
+    // Search once typing pauses, not for every key
+    Timer {
+        id: searchTimer
+
+        interval: 250
+
+        onTriggered: app.setSearchQuery(searchField.text)
+    }
+
+    // Replaces the tabs while searching
+    ListView {
+        anchors.top: searchField.bottom
+        anchors.bottom: parent.bottom
+        anchors.left: parent.left
+        anchors.right: parent.right
+
+        visible: searchField.text.length > 0
+        clip: true
+
+        model: app.searchModel
+        delegate: bookDelegate
+    }
+
     TabBar {
         id: tabs
 
-        anchors.top: parent.top
+        anchors.top: searchField.bottom
         width: parent.width
 
+        visible: searchField.text.length == 0
+
         currentIndex: libraryView.currentIndex
 
         onCurrentIndexChanged: libraryView.currentIndex = currentIndex
@@ -38,6 +88,8 @@ Kirigami.Page {
     SwipeView {
         id: libraryView
 
+        visible: tabs.visible
+
         anchors.top: tabs.bottom
         anchors.bottom: parent.bottom
         anchors.left: parent.left
@@ -50,31 +102,41 @@ Kirigami.Page {
                 anchors.fill: parent
 
                 model: app.booksModel()
-
-                delegate: Kirigami.BasicListItem {
-                    id: listItem
-
-                    reserveSpaceForIcon: false
-                    label: model.title
-
-                    onClicked: {
-                        mainPage.playBook(model.id)
-                        root.pageStack.pop()
-                    }
-                }
+                delegate: bookDelegate
             }
         }
 
         Item {
             id: newPage
+
+            ListView {
+                anchors.fill: parent
+
+                model: app.booksModel(0)
+                delegate: bookDelegate
+            }
         }
 
         Item {
             id: startedPage
+
+            ListView {
+                anchors.fill: parent
+
+                model: app.booksModel(1)
+                delegate: bookDelegate
+            }
         }
 
         Item {
             id: finishedPage
+
+            ListView {
+                anchors.fill: parent
+
+                model: app.booksModel(2)
+                delegate: bookDelegate
+            }
         }
     }
 }
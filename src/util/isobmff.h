@@ -56,9 +56,9 @@ struct atom_header {
         return input;
     }
 
-    static constexpr std::array<const char[5],19> _CONTAINERS {{
+    static constexpr std::array<const char[5],20> _CONTAINERS {{
         "moov", "udta", "trak", "mdia", "meta", "ilst", "stbl", "mind", "moof", "traf",
-        "minf", "cmov", "rmra", "rmda", "matt", "edts", "dinf", "stbl", "sinf"
+        "minf", "cmov", "rmra", "rmda", "matt", "edts", "dinf", "stbl", "sinf", "mvex"
     }};
     static constexpr std::array<std::pair<const char*, unsigned>, 1> _SKIP_SIZE {{
         {"meta", 4}
@@ -391,6 +391,186 @@ struct hdlr {
     }
 };
 
+// Fragmented MP4
+struct mehd {
+    uint8_t version;
+    uint32_t flags;
+    uint64_t fragment_duration;
+
+    friend std::istream &operator >>(std::istream &stream, mehd &self) {
+        std::tie(self.version, self.flags) = read_version_flags(stream);
+        if (self.version == 1)
+            self.fragment_duration = readbe<uint64_t>(stream);
+        else
+            self.fragment_duration = readbe<uint32_t>(stream);
+        return stream;
+    }
+};
+
+struct trex {
+    uint8_t version;
+    uint32_t flags;
+    uint32_t track_id;
+    uint32_t default_sample_description_index;
+    uint32_t default_sample_duration;
+    uint32_t default_sample_size;
+    uint32_t default_sample_flags;
+
+    friend std::istream &operator >>(std::istream &stream, trex &self) {
+        std::tie(self.version, self.flags) = read_version_flags(stream);
+        self.track_id                         = readbe<uint32_t>(stream);
+        self.default_sample_description_index = readbe<uint32_t>(stream);
+        self.default_sample_duration          = readbe<uint32_t>(stream);
+        self.default_sample_size              = readbe<uint32_t>(stream);
+        self.default_sample_flags             = readbe<uint32_t>(stream);
+        return stream;
+    }
+};
+
+struct sidx {
+    struct reference {
+        bool is_index;      // references another sidx instead of media
+        uint32_t size;
+        uint32_t duration;
+    };
+
+    uint8_t version;
+    uint32_t flags;
+    uint32_t reference_id;
+    uint32_t timescale;
+    uint64_t earliest_presentation_time;
+    uint64_t first_offset;
+    std::vector<reference> references;
+
+    friend std::istream &operator >>(std::istream &stream, sidx &self) {
+        std::tie(self.version, self.flags) = read_version_flags(stream);
+        self.reference_id = readbe<uint32_t>(stream);
+        self.timescale    = readbe<uint32_t>(stream);
+        if (self.version == 0) {
+            self.earliest_presentation_time = readbe<uint32_t>(stream);
+            self.first_offset               = readbe<uint32_t>(stream);
+        } else {
+            self.earliest_presentation_time = readbe<uint64_t>(stream);
+            self.first_offset               = readbe<uint64_t>(stream);
+        }
+        stream.seekg(2, std::ios_base::cur); // reserved
+        uint16_t count = readbe<uint16_t>(stream);
+        self.references.resize(count);
+        for (auto &ref : self.references) {
+            uint32_t type_size = readbe<uint32_t>(stream);
+            ref.is_index = type_size & 0x80000000;
+            ref.size     = type_size & 0x7FFFFFFF;
+            ref.duration = readbe<uint32_t>(stream);
+            stream.seekg(4, std::ios_base::cur); // SAP
+        }
+        return stream;
+    }
+
+    uint64_t duration() const {
+        uint64_t d = 0;
+        for (auto &ref : references)
+            if (!ref.is_index)
+                d += ref.duration;
+        return d;
+    }
+};
+
+struct tfhd {
+    static constexpr uint32_t BASE_DATA_OFFSET         = 0x000001;
+    static constexpr uint32_t SAMPLE_DESCRIPTION_INDEX = 0x000002;
+    static constexpr uint32_t DEFAULT_SAMPLE_DURATION  = 0x000008;
+
+    uint8_t version;
+    uint32_t flags;
+    uint32_t track_id;
+    uint32_t default_sample_duration = 0;
+
+    bool has_default_sample_duration() const {
+        return flags & DEFAULT_SAMPLE_DURATION;
+    }
+
+    friend std::istream &operator >>(std::istream &stream, tfhd &self) {
+        std::tie(self.version, self.flags) = read_version_flags(stream);
+        self.track_id = readbe<uint32_t>(stream);
+        if (self.flags & BASE_DATA_OFFSET)
+            stream.seekg(8, std::ios_base::cur);
+        if (self.flags & SAMPLE_DESCRIPTION_INDEX)
+            stream.seekg(4, std::ios_base::cur);
+        if (self.flags & DEFAULT_SAMPLE_DURATION)
+            self.default_sample_duration = readbe<uint32_t>(stream);
+        // default size & flags aren't interesting
+        return stream;
+    }
+};
+
+struct tfdt {
+    uint8_t version;
+    uint32_t flags;
+    uint64_t base_media_decode_time;
+
+    friend std::istream &operator >>(std::istream &stream, tfdt &self) {
+        std::tie(self.version, self.flags) = read_version_flags(stream);
+        if (self.version == 1)
+            self.base_media_decode_time = readbe<uint64_t>(stream);
+        else
+            self.base_media_decode_time = readbe<uint32_t>(stream);
+        return stream;
+    }
+};
+
+/**
+ * @brief Track fragment run. Only reads what's needed to get at the run's duration
+ */
+struct trun {
+    static constexpr uint32_t DATA_OFFSET             = 0x000001;
+    static constexpr uint32_t FIRST_SAMPLE_FLAGS      = 0x000004;
+    static constexpr uint32_t SAMPLE_DURATION         = 0x000100;
+    static constexpr uint32_t SAMPLE_SIZE             = 0x000200;
+    static constexpr uint32_t SAMPLE_FLAGS            = 0x000400;
+    static constexpr uint32_t SAMPLE_COMPOSITION_TIME = 0x000800;
+
+    uint8_t version;
+    uint32_t flags;
+    uint32_t sample_count;
+    // Only valid if flags & SAMPLE_DURATION
+    uint64_t total_sample_duration = 0;
+
+    bool has_sample_durations() const {
+        return flags & SAMPLE_DURATION;
+    }
+
+    uint64_t duration(uint32_t default_sample_duration) const {
+        if (has_sample_durations())
+            return total_sample_duration;
+        return (uint64_t)sample_count * default_sample_duration;
+    }
+
+    friend std::istream &operator >>(std::istream &stream, trun &self) {
+        std::tie(self.version, self.flags) = read_version_flags(stream);
+        self.sample_count = readbe<uint32_t>(stream);
+        if (self.flags & DATA_OFFSET)
+            stream.seekg(4, std::ios_base::cur);
+        if (self.flags & FIRST_SAMPLE_FLAGS)
+            stream.seekg(4, std::ios_base::cur);
+
+        if (!self.has_sample_durations())
+            return stream;
+
+        // Skip over the other per-sample fields
+        int skip = 0;
+        for (uint32_t f : {SAMPLE_SIZE, SAMPLE_FLAGS, SAMPLE_COMPOSITION_TIME})
+            if (self.flags & f)
+                skip += 4;
+
+        for (uint32_t i = 0; i < self.sample_count && stream; i++) {
+            self.total_sample_duration += readbe<uint32_t>(stream);
+            if (skip)
+                stream.seekg(skip, std::ios_base::cur);
+        }
+        return stream;
+    }
+};
+
 template <typename T>
 concept CustomReadAtom = requires(T &a, atom_header const &h, std::istream &s) {
     { a.read_atom(s, h) };
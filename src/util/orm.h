@@ -5,6 +5,7 @@
 #include "tuple_util.h"
 
 #include <utility>
+#include <vector>
 
 #include <QString>
 #include <QList>
@@ -25,6 +26,8 @@ struct constraint {};
 
 struct references_tag {};
 
+struct index_tag {};
+
 struct sql_query_type {};
 
 template <typename T>
@@ -42,6 +45,9 @@ struct is_specialization<Ref<Args...>, Ref>: std::true_type {};
 template <typename T>
 using is_tuple = is_specialization<T, std::tuple>;
 
+template <typename T>
+using is_vector = is_specialization<T, std::vector>;
+
 // Misc
 template <typename T>
 struct map_type_type {
@@ -64,6 +70,9 @@ using is_constraint = std::is_base_of<detail::constraint, T>;
 template <typename T>
 using is_references_clause = std::is_base_of<detail::references_tag, T>;
 
+template <typename T>
+using is_index = std::is_base_of<detail::index_tag, T>;
+
 template <typename T>
 concept BoundSQL = std::is_base_of<detail::sql_query_type, T>::value;
 
@@ -77,7 +86,7 @@ concept SQLQuery = requires(T const a) {{a.sqlQuery()} -> BoundSQL;};
  */
 template<typename T>
 struct schema_type {
-    // static constexpr const char *value;
+    // static constexpr auto value = "TYPE"_T;
 };
 
 /**
@@ -110,12 +119,12 @@ struct nullable_type {
 // ---------------
 // Long
 template<> struct schema_type<long> {
-    static constexpr const char *value = "INTEGER";
+    static constexpr auto value = "INTEGER"_T;
 };
 
 // QString
 template<> struct schema_type<QString> {
-    static constexpr const char *value = "TEXT";
+    static constexpr auto value = "TEXT"_T;
 };
 
 template<> struct nullable_type<QString> {
@@ -141,7 +150,7 @@ template<> struct nullable_type<QString> {
 
 // QByteArray
 template<> struct schema_type<QByteArray> {
-    static constexpr const char *value = "BLOB";
+    static constexpr auto value = "BLOB"_T;
 };
 
 // -----------------------------------------------------------------------
@@ -211,6 +220,22 @@ struct SQL : detail::sql_query_type {
 template <typename... Ts> SQL(QString, const std::tuple<Ts...> &) -> SQL<Ts...>;
 template <typename... Ts> SQL(QString, std::tuple<Ts...> &&) -> SQL<Ts...>;
 
+/**
+ * @brief Call f with each value to bind for the binds of a query, in placeholder order
+ * A std::vector bind stands for one placeholder per element, see Expr::In.
+ */
+template <typename... Ts, typename F>
+void sql_foreach_bind_value(const std::tuple<Ts...> &binds, F &&f) {
+    Util::tuple_foreach(binds, [&f] (const auto &b) {
+        if constexpr (detail::is_vector<std::decay_t<decltype(b)>>::value) {
+            for (const auto &v : b)
+                f(v);
+        } else {
+            f(b);
+        }
+    });
+}
+
 template <typename... Us>
 inline SQL<std::decay_t<Us>...> sql(const QString &q, Us&&... binds) {
     return SQL<std::decay_t<Us>...>{q, {std::forward<Us>(binds)...}};
@@ -261,6 +286,45 @@ auto sql_parenthesize(const SQL<Ts...> &sql) -> SQL<Ts...> {
 }
 
 
+// Compile-time SQL text
+namespace detail {
+template <typename TStr>
+struct qstring_literal;
+
+template <char... str>
+struct qstring_literal<tstring<char, str...>> {
+    static_assert(((str >= 0) && ...), "SQL literals must be ASCII");
+    static constexpr int size = sizeof...(str);
+
+    // Same layout QStringLiteral uses
+    static inline const QStaticStringData<size> data = {
+        Q_STATIC_STRING_DATA_HEADER_INITIALIZER(size),
+        {static_cast<qunicodechar>(str)..., 0}
+    };
+};
+}
+
+/**
+ * @brief Make a QString referring to static tstring data
+ * Neither allocates nor copies, just like QStringLiteral
+ */
+template <char... str>
+inline QString tstring_qstring(tstring<char, str...>) {
+    QStringDataPtr holder{detail::qstring_literal<tstring<char, str...>>::data.data_ptr()};
+    return QString(holder);
+}
+
+template <typename TStr>
+inline SQL<> sql_static(TStr text) {
+    return {tstring_qstring(text)};
+}
+
+template <typename TStr, typename... Binds>
+inline SQL<Binds...> sql_static(TStr text, std::tuple<Binds...> &&binds) {
+    return {tstring_qstring(text), std::move(binds)};
+}
+
+
 // -----------------------------------------------------------------------
 // Expressions
 
@@ -278,7 +342,20 @@ template <Expression, Expression> struct Or;
 template <Expression, Expression> struct Eq;
 template <Expression, Expression> struct Less;
 template <Expression, Expression> struct Greater;
-template <typename, Expression...> struct Fn;
+template <Expression, Expression> struct Match;
+template <Expression, typename> struct In;
+template <typename, typename, Expression...> struct Fn;
+
+/**
+ * @brief An expression whose SQL text is fully determined by its type
+ * sqlText<P>() gives the text when embedded into an expression of precedence P,
+ * sqlBinds() the values to bind at runtime.
+ */
+template <typename T>
+concept StaticExpression = Expression<T> && requires(T const a) {
+    T::template sqlText<0>();
+    {a.sqlBinds()};
+};
 
 template <typename T>
 auto toExpr(const T &x) {
@@ -325,6 +402,16 @@ public:
     auto operator > (const U &o) const {
         return make_binary<Greater>(o);
     }
+
+    template <typename U>
+    auto in(std::vector<U> values) const {
+        return In<Self, U>(self(), std::move(values));
+    }
+
+    template <typename U>
+    auto match(const U &o) const {
+        return make_binary<Match>(o);
+    }
 };
 
 template <typename Self>
@@ -387,19 +474,39 @@ struct BinaryExpression : ExpressionBase<Self, T> {
         lhs(lhs), rhs(rhs)
     {}
 
-    auto sqlExpression(int into_prec=100) const {
-        QString fmt;
-        if (into_prec < prec)
-            fmt = QStringLiteral("(%1 %0 %2)");
+    template <int IntoPrec>
+    static constexpr auto sqlText() requires (StaticExpression<Lhs> && StaticExpression<Rhs>) {
+        constexpr auto text = tstring_join(" "_T, Lhs::template sqlText<prec>(), Self::binary_op, Rhs::template sqlText<prec>());
+        if constexpr (IntoPrec < prec)
+            return tstring_concat("("_T, text, ")"_T);
         else
-            fmt = QStringLiteral("%1 %0 %2");
-        fmt = fmt.arg(this->self().binary_op);
+            return text;
+    }
 
-        auto left = lhs.sqlExpression(prec);
-        auto right = rhs.sqlExpression(prec);
+    auto sqlBinds() const requires (StaticExpression<Lhs> && StaticExpression<Rhs>) {
+        return std::tuple_cat(lhs.sqlBinds(), rhs.sqlBinds());
+    }
 
-        return SQL{fmt.arg(left.query).arg(right.query),
-                   std::tuple_cat(left.binds, right.binds)};
+    auto sqlExpression(int into_prec=100) const {
+        if constexpr (StaticExpression<Lhs> && StaticExpression<Rhs>) {
+            if (into_prec < prec)
+                return sql_static(sqlText<0>(), sqlBinds());
+            else
+                return sql_static(sqlText<prec>(), sqlBinds());
+        } else {
+            QString fmt;
+            if (into_prec < prec)
+                fmt = QStringLiteral("(%1 %0 %2)");
+            else
+                fmt = QStringLiteral("%1 %0 %2");
+            fmt = fmt.arg(Self::binary_op.value);
+
+            auto left = lhs.sqlExpression(prec);
+            auto right = rhs.sqlExpression(prec);
+
+            return SQL{fmt.arg(left.query).arg(right.query),
+                       std::tuple_cat(left.binds, right.binds)};
+        }
     }
 };
 
@@ -419,8 +526,17 @@ struct Value : detail::ExpressionBase<Value<T>, T> {
         value(std::move(val))
     {}
 
+    template <int>
+    static constexpr auto sqlText() {
+        return "?"_T;
+    }
+
+    std::tuple<T> sqlBinds() const {
+        return {value};
+    }
+
     SQL<T> sqlExpression(int=0) const {
-        return ORM::sql("?", value);
+        return sql_static(sqlText<0>(), sqlBinds());
     }
 };
 
@@ -443,9 +559,22 @@ struct Not : detail::ExpressionBase<Not<Expr>, bool> {
     //    expr(std::move(expr))
     //{}
 
+    template <int>
+    static constexpr auto sqlText() requires StaticExpression<Expr> {
+        return tstring_concat("NOT "_T, Expr::template sqlText<0>());
+    }
+
+    auto sqlBinds() const requires StaticExpression<Expr> {
+        return expr.sqlBinds();
+    }
+
     auto sqlExpression(int=0) const -> decltype(expr.sqlExpression(0)) {
-        auto inner = expr.sqlExpression(0);
-        return SQL{QStringLiteral("NOT " + inner.query), inner.binds};
+        if constexpr (StaticExpression<Expr>)
+            return sql_static(sqlText<0>(), sqlBinds());
+        else {
+            auto inner = expr.sqlExpression(0);
+            return SQL{QStringLiteral("NOT ") + inner.query, inner.binds};
+        }
     }
 };
 
@@ -453,7 +582,7 @@ struct Not : detail::ExpressionBase<Not<Expr>, bool> {
 template <Expression Lhs, Expression Rhs>
 struct And : detail::BinaryExpression<And<Lhs, Rhs>, bool, 70, Lhs, Rhs> {
     using detail::BinaryExpression<And<Lhs, Rhs>, bool, 70, Lhs, Rhs>::BinaryExpression;
-    static constexpr const char *binary_op = "AND";
+    static constexpr auto binary_op = "AND"_T;
 };
 
 template <Expression A, Expression B> And(A, B) -> And<A, B>;
@@ -462,7 +591,7 @@ template <Expression A, Expression B> And(A, B) -> And<A, B>;
 template <Expression Lhs, Expression Rhs>
 struct Or : detail::BinaryExpression<Or<Lhs, Rhs>, bool, 80, Lhs, Rhs> {
     using detail::BinaryExpression<Or<Lhs,Rhs>,bool,80,Lhs,Rhs>::BinaryExpression;
-    static constexpr const char *binary_op = "OR";
+    static constexpr auto binary_op = "OR"_T;
 };
 
 template <Expression A, Expression B> Or(A, B) -> Or<A, B>;
@@ -471,7 +600,7 @@ template <Expression A, Expression B> Or(A, B) -> Or<A, B>;
 template <Expression Lhs, Expression Rhs>
 struct Eq : detail::BinaryExpression<Eq<Lhs, Rhs>, bool, 60, Lhs, Rhs> {
     using detail::BinaryExpression<Eq<Lhs,Rhs>,bool,60,Lhs,Rhs>::BinaryExpression;
-    static constexpr const char *binary_op = "=";
+    static constexpr auto binary_op = "="_T;
 };
 
 template <Expression A, Expression B> Eq(A, B) -> Eq<A, B>;
@@ -480,59 +609,164 @@ template <Expression A, Expression B> Eq(A, B) -> Eq<A, B>;
 template <Expression Lhs, Expression Rhs>
 struct Less : detail::BinaryExpression<Less<Lhs, Rhs>, bool, 50, Lhs, Rhs> {
     using detail::BinaryExpression<Less<Lhs,Rhs>,bool,50,Lhs,Rhs>::BinaryExpression;
-    static constexpr const char *binary_op = "<";
+    static constexpr auto binary_op = "<"_T;
 };
 
 /// @brief Greater than
 template <Expression Lhs, Expression Rhs>
 struct Greater : detail::BinaryExpression<Greater<Lhs, Rhs>, bool, 50, Lhs, Rhs> {
     using detail::BinaryExpression<Greater<Lhs,Rhs>,bool,50,Lhs,Rhs>::BinaryExpression;
-    static constexpr const char *binary_op = ">";
+    static constexpr auto binary_op = ">"_T;
+};
+
+/// @brief Full-text query against an FTS5 table or one of its columns
+template <Expression Lhs, Expression Rhs>
+struct Match : detail::BinaryExpression<Match<Lhs, Rhs>, bool, 60, Lhs, Rhs> {
+    using detail::BinaryExpression<Match<Lhs,Rhs>,bool,60,Lhs,Rhs>::BinaryExpression;
+    static constexpr auto binary_op = "MATCH"_T;
+};
+
+/// @brief Membership in a list of values
+/// @note The list is bound as a single std::vector, which binders expand to one placeholder per value
+template <Expression Expr, typename T>
+struct In : detail::ExpressionBase<In<Expr, T>, bool> {
+    static constexpr int prec = 60;
+
+    Expr expr;
+    std::vector<T> values;
+
+    In(const Expr &expr, std::vector<T> values) :
+        expr(expr), values(std::move(values))
+    {}
+
+    auto sqlExpression(int into_prec=100) const {
+        QStringList phs;
+        phs.reserve(values.size());
+        for (size_t i = 0; i < values.size(); i++)
+            phs.append(QStringLiteral("?"));
+
+        QString fmt;
+        if (into_prec < prec)
+            fmt = QStringLiteral("(%1 IN (%2))");
+        else
+            fmt = QStringLiteral("%1 IN (%2)");
+
+        auto e = expr.sqlExpression(prec);
+        return SQL{fmt.arg(e.query).arg(phs.join(", ")),
+                   std::tuple_cat(e.binds, std::tuple<std::vector<T>>(values))};
+    }
 };
 
 /// @brief SQL functions
-template <typename T, Expression... Args>
-struct Fn : detail::ExpressionBase<Fn<T, Args...>, T> {
-    QString name;
+/// @tparam Name [typename Util::tstring<char,...>] Function name
+template <typename T, typename Name, Expression... Args>
+struct Fn : detail::ExpressionBase<Fn<T, Name, Args...>, T> {
+    static constexpr auto name = Name();
+
     std::tuple<Args...> arguments;
 
-    Fn(QString name, Args... args) :
-        name(name), arguments(args...)
+    constexpr Fn(Name, Args... args) :
+        arguments(args...)
     {}
 
     template <typename... Us>
-    Fn(QString name, const Us &... args) :
-        name(name), arguments(toExpr(args)...)
+    Fn(Name, const Us &... args) :
+        arguments(toExpr(args)...)
     {}
 
+    template <int>
+    static constexpr auto sqlText() requires (StaticExpression<Args> && ...) {
+        return tstring_concat(name, "("_T, tstring_join(", "_T, Args::template sqlText<100>()...), ")"_T);
+    }
+
+    auto sqlBinds() const requires (StaticExpression<Args> && ...) {
+        return std::apply([](const auto &... a) {return std::tuple_cat(a.sqlBinds()...);}, arguments);
+    }
+
     auto sqlExpression(int=0) const {
-        auto templ = QStringLiteral("%0(%1)").arg(name);
-        auto args = sql_join2(", ", Util::tuple_map(arguments, [](auto a){return a.sqlExpression();}));
-        return SQL{templ.arg(args.query), args.binds};
+        if constexpr ((StaticExpression<Args> && ...))
+            return sql_static(sqlText<0>(), sqlBinds());
+        else {
+            auto templ = QStringLiteral("%0(%1)").arg(name.value);
+            auto args = sql_join2(", ", Util::tuple_map(arguments, [](auto a){return a.sqlExpression();}));
+            return SQL{templ.arg(args.query), args.binds};
+        }
     }
 };
 
 /// @brief SQLite datetime() function
 template <Expression Expr>
-Fn<void, Expr> datetime(Expr e) {
-    return {"datetime", e};
+constexpr Fn<void, TSTR("datetime"), Expr> datetime(Expr e) {
+    return {"datetime"_T, e};
+}
+
+template <Expression Expr>
+Fn<long, TSTR("sum"), Expr> sum(Expr e) {
+    return {"sum"_T, e};
 }
 
 template <Expression Expr>
-Fn<long, Expr> sum(Expr e) {
-    return {"sum", e};
+Fn<long, TSTR("min"), Expr> min(Expr e) {
+    return {"min"_T, e};
 }
 
+/// @brief FTS5 relevance, lower is better
 template <Expression Expr>
-Fn<long, Expr> min(Expr e) {
-    return {"min", e};
+Fn<double, TSTR("bm25"), Expr> bm25(Expr e) {
+    return {"bm25"_T, e};
 }
 
 inline
-Fn<long> count() {
-    return {"count"};
+Fn<long, TSTR("count")> count() {
+    return {"count"_T};
 }
 
+template <Expression Expr>
+Fn<long, TSTR("count"), Expr> count(Expr e) {
+    return {"count"_T, e};
+}
+
+/// @brief A column qualified by its table, as needed in joins
+/// @note Create using Table[column]
+template <typename Tbl, typename Col>
+struct Qualified : detail::ExpressionBase<Qualified<Tbl, Col>, typename Col::type> {
+    using Table = Tbl;
+    using Column = Col;
+
+    template <int>
+    static constexpr auto sqlText() {
+        return tstring_concat(Tbl::name, "."_T, Col::name);
+    }
+
+    static std::tuple<> sqlBinds() {
+        return {};
+    }
+
+    SQL<> sqlExpression(int=0) const {
+        return sql_static(sqlText<0>());
+    }
+};
+
+/// @brief A table by name, as FTS5 uses it for MATCH and its ranking functions
+/// @note Create using Table::ref()
+template <typename Tbl>
+struct TableRef : detail::ExpressionBase<TableRef<Tbl>, void> {
+    using Table = Tbl;
+
+    template <int>
+    static constexpr auto sqlText() {
+        return Tbl::name;
+    }
+
+    static std::tuple<> sqlBinds() {
+        return {};
+    }
+
+    SQL<> sqlExpression(int=0) const {
+        return sql_static(sqlText<0>());
+    }
+};
+
 // Ensure concepts
 struct Stub {
     using type = int;
@@ -542,11 +776,30 @@ struct Stub {
     }
 };
 
+struct StaticStub : Stub {
+    template <int>
+    static constexpr auto sqlText() {
+        return "1"_T;
+    }
+
+    static std::tuple<> sqlBinds() {
+        return {};
+    }
+};
+
 static_assert(Expression<Value<long>>);
 static_assert(Expression<Not<Value<bool>>>);
 static_assert(Expression<Eq<Stub, Stub>>);
 static_assert(Expression<And<Stub, Stub>>);
-static_assert(Expression<Fn<long>>);
+static_assert(Expression<Fn<long, TSTR("count")>>);
+static_assert(Expression<In<Stub, long>>);
+static_assert(!StaticExpression<In<StaticStub, long>>);
+static_assert(StaticExpression<Value<long>>);
+static_assert(StaticExpression<Eq<StaticStub, Value<long>>>);
+static_assert(StaticExpression<Match<StaticStub, Value<long>>>);
+static_assert(!StaticExpression<Eq<Stub, Value<long>>>);
+static_assert(std::is_same_v<decltype(And<Eq<StaticStub, StaticStub>, StaticStub>::sqlText<100>()), decltype("1 = 1 AND 1"_T)>);
+static_assert(std::is_same_v<decltype(Fn<long, TSTR("count")>::sqlText<0>()), decltype("count()"_T)>);
 }
 
 namespace Sel {
@@ -571,6 +824,89 @@ concept SourceExpression = requires (T const a) {
 template <typename T>
 concept Source = SourceTable<T> || SourceExpression<T>;
 
+/// @brief A source with a typed row, one element per selected expression
+template <typename T>
+concept Projection = Source<T> && requires {
+    typename T::Row;
+};
+
+/// @brief A constraint whose SQL text is fully determined by its type
+template <typename T>
+concept StaticConstraint = Constraint<T> && requires (T const a) {
+    T::sqlText();
+    {a.sqlBinds()};
+};
+
+/// @brief A source whose column list and table name are fully determined by its type
+template <typename T>
+concept StaticSource = Source<T> && requires (T const a) {
+    T::sqlColumnsText();
+    T::sqlTableText();
+    {a.sqlBinds()};
+};
+
+/**
+ * @brief Tables joined with JOIN or LEFT JOIN
+ * Created using Table::join() and Table::leftJoin(), and used as the table of a From.
+ */
+template <typename Left, typename Right, Expr::Expression On, bool Outer>
+struct Join {
+    static_assert(ORM::Expr::StaticExpression<On>, "Join conditions must have static SQL text");
+
+    Left left;
+    On on;
+
+    Join(const Left &left, Right, const On &on) :
+        left(left), on(on)
+    {}
+
+    static constexpr auto sqlTableText() {
+        if constexpr (Outer)
+            return tstring_concat(Left::sqlTableText(), " LEFT JOIN "_T, Right::name, " ON "_T, On::template sqlText<100>());
+        else
+            return tstring_concat(Left::sqlTableText(), " JOIN "_T, Right::name, " ON "_T, On::template sqlText<100>());
+    }
+
+    auto sqlBinds() const {
+        return std::tuple_cat(left.sqlBinds(), on.sqlBinds());
+    }
+
+    QString getTableName() const {
+        return tstring_qstring(sqlTableText());
+    }
+
+    template <typename Tbl, Expr::Expression Cond>
+    auto join(Tbl t, const Cond &cond) const {
+        return Join<Join, Tbl, Cond, false>(*this, t, cond);
+    }
+
+    template <typename Tbl, Expr::Expression Cond>
+    auto leftJoin(Tbl t, const Cond &cond) const {
+        return Join<Join, Tbl, Cond, true>(*this, t, cond);
+    }
+};
+
+namespace detail {
+// Whether rows of Tbl may be missing from the results of Src
+template <typename Src, typename Tbl>
+inline constexpr bool is_outer_joined = false;
+
+template <typename Left, typename Right, typename On, bool Outer, typename Tbl>
+inline constexpr bool is_outer_joined<Join<Left, Right, On, Outer>, Tbl> =
+        (Outer && std::is_same_v<Right, Tbl>) || is_outer_joined<Left, Tbl>;
+
+// Result type of an expression selected from Src
+template <typename Src, typename E>
+struct projection_type {
+    using type = typename E::type;
+};
+
+template <typename Src, typename Tbl, typename Col> requires is_outer_joined<Src, Tbl>
+struct projection_type<Src, Expr::Qualified<Tbl, Col>> {
+    using type = typename Col::nullable_type::type;
+};
+}
+
 template <Expr::Expression Expr>
 struct Where {
     Expr expr;
@@ -579,9 +915,21 @@ struct Where {
         expr(expr)
     {}
 
+    static constexpr auto sqlText() requires ORM::Expr::StaticExpression<Expr> {
+        return tstring_concat("WHERE "_T, Expr::template sqlText<100>());
+    }
+
+    auto sqlBinds() const requires ORM::Expr::StaticExpression<Expr> {
+        return expr.sqlBinds();
+    }
+
     auto sqlSelectConstraint() const {
-        auto sql = expr.sqlExpression();
-        return SQL{"WHERE " + sql.query, sql.binds};
+        if constexpr (ORM::Expr::StaticExpression<Expr>)
+            return sql_static(sqlText(), sqlBinds());
+        else {
+            auto sql = expr.sqlExpression();
+            return SQL{"WHERE " + sql.query, sql.binds};
+        }
     }
 };
 
@@ -595,6 +943,8 @@ struct Select {
     {}
 
 private:
+    static constexpr bool is_static = StaticSource<From> && (StaticConstraint<Constraints> && ...);
+
     auto make_sql(QString templ) const {
         auto cols = [this]() {
             if constexpr (SourceTable<From>)
@@ -606,13 +956,40 @@ private:
         return SQL{templ.arg(cols.query).arg(source.getTableName()).arg(cs.query), std::tuple_cat(cols.binds, cs.binds)};
     }
 
+    static constexpr auto selectText() requires is_static {
+        return tstring_concat("SELECT "_T, From::sqlColumnsText(), " FROM "_T, From::sqlTableText(),
+                              tstring_concat(" "_T, Constraints::sqlText())...);
+    }
+
 public:
+    // Statement
+    static constexpr auto sqlQueryText() requires is_static {
+        return tstring_concat(selectText(), ";"_T);
+    }
+
+    auto sqlBinds() const requires is_static {
+        return std::tuple_cat(source.sqlBinds(),
+                              std::apply([](const auto &... c) {return std::tuple_cat(c.sqlBinds()...);}, constraints));
+    }
+
     auto sqlQuery() const {
-        return make_sql(QStringLiteral("SELECT %0 FROM %1 %2;"));
+        if constexpr (is_static)
+            return sql_static(sqlQueryText(), sqlBinds());
+        else
+            return make_sql(QStringLiteral("SELECT %0 FROM %1 %2;"));
+    }
+
+    // Subquery
+    template <int>
+    static constexpr auto sqlText() requires is_static {
+        return tstring_concat("("_T, selectText(), ")"_T);
     }
 
     auto sqlExpression(int=0) const {
-        return make_sql(QStringLiteral("(SELECT %0 FROM %1 %2)"));
+        if constexpr (is_static)
+            return sql_static(sqlText<0>(), sqlBinds());
+        else
+            return make_sql(QStringLiteral("(SELECT %0 FROM %1 %2)"));
     }
 };
 
@@ -626,34 +1003,122 @@ struct Limit {
         limit(limit)
     {}
 
+    static constexpr auto sqlText() {
+        return "LIMIT ?"_T;
+    }
+
+    std::tuple<size_t> sqlBinds() const {
+        return {limit};
+    }
+
     SQL<size_t> sqlSelectConstraint() const {
-        return SQL{QStringLiteral("LIMIT ?"), std::tuple{limit}};
+        return sql_static(sqlText(), sqlBinds());
     }
 };
 
-template <Expr::Expression Expr>
+// Must follow Limit
+struct Offset {
+    size_t offset;
+
+    Offset(size_t offset) :
+        offset(offset)
+    {}
+
+    static constexpr auto sqlText() {
+        return "OFFSET ?"_T;
+    }
+
+    std::tuple<size_t> sqlBinds() const {
+        return {offset};
+    }
+
+    SQL<size_t> sqlSelectConstraint() const {
+        return sql_static(sqlText(), sqlBinds());
+    }
+};
+
+template <Expr::Expression... Exprs>
+struct GroupBy {
+    std::tuple<Exprs...> exprs;
+
+    GroupBy(const Exprs &... exprs) :
+        exprs(exprs...)
+    {}
+
+    static constexpr auto sqlText() requires (ORM::Expr::StaticExpression<Exprs> && ...) {
+        return tstring_concat("GROUP BY "_T, tstring_join(", "_T, Exprs::template sqlText<100>()...));
+    }
+
+    auto sqlBinds() const requires (ORM::Expr::StaticExpression<Exprs> && ...) {
+        return std::apply([](const auto &... e) {return std::tuple_cat(e.sqlBinds()...);}, exprs);
+    }
+
+    auto sqlSelectConstraint() const {
+        if constexpr ((ORM::Expr::StaticExpression<Exprs> && ...))
+            return sql_static(sqlText(), sqlBinds());
+        else {
+            auto sql = sql_join2(", ", Util::tuple_map(exprs, [](auto e) {return e.sqlExpression();}));
+            return SQL{"GROUP BY " + sql.query, sql.binds};
+        }
+    }
+};
+
+// Sort order tags
+struct Ascending_t {};
+struct Descending_t {};
+inline constexpr Ascending_t Ascending;
+inline constexpr Descending_t Descending;
+
+template <Expr::Expression Expr, bool Desc=false>
 struct OrderBy {
+    static constexpr bool descending = Desc;
+
     Expr expr;
-    bool descending = false;
 
-    OrderBy(const Expr &expr, bool desc=false) :
-        expr(expr), descending(desc)
+    OrderBy(const Expr &expr) :
+        expr(expr)
     {}
 
-    SQL<> sqlSelectConstraint() const {
-        auto sql = expr.sqlExpression(0);
-        return SQL{QStringLiteral("ORDER BY %0%1")
-                    .arg(sql.query)
-                    .arg(descending ? " DESC" : ""),
-                sql.binds};
+    OrderBy(const Expr &expr, Ascending_t) requires (!Desc) :
+        expr(expr)
+    {}
+
+    OrderBy(const Expr &expr, Descending_t) requires Desc :
+        expr(expr)
+    {}
+
+    static constexpr auto sqlText() requires ORM::Expr::StaticExpression<Expr> {
+        if constexpr (descending)
+            return tstring_concat("ORDER BY "_T, Expr::template sqlText<0>(), " DESC"_T);
+        else
+            return tstring_concat("ORDER BY "_T, Expr::template sqlText<0>());
+    }
+
+    auto sqlBinds() const requires ORM::Expr::StaticExpression<Expr> {
+        return expr.sqlBinds();
+    }
+
+    auto sqlSelectConstraint() const {
+        if constexpr (ORM::Expr::StaticExpression<Expr>)
+            return sql_static(sqlText(), sqlBinds());
+        else {
+            auto sql = expr.sqlExpression(0);
+            return SQL{QStringLiteral("ORDER BY %0%1")
+                        .arg(sql.query)
+                        .arg(descending ? " DESC" : ""),
+                    sql.binds};
+        }
     }
 };
 
 template <Expr::Expression E>
-OrderBy(const E &) -> OrderBy<E>;
+OrderBy(const E &) -> OrderBy<E, false>;
+
+template <Expr::Expression E>
+OrderBy(const E &, Ascending_t) -> OrderBy<E, false>;
 
 template <Expr::Expression E>
-OrderBy(const E &, bool) -> OrderBy<E>;
+OrderBy(const E &, Descending_t) -> OrderBy<E, true>;
 
 
 template<typename Tbl, typename... Cols>
@@ -663,6 +1128,9 @@ struct Columns {
     static constexpr auto columns = typename Columns_::tuple();
 
     static_assert (Columns_::template all<is_column>(), "Invalid column argument");
+    static_assert ((Tbl::Columns::template contains<Cols> && ...), "Column not in table");
+
+    using Row = std::tuple<typename Cols::type...>;
 
     constexpr Columns() {}
     constexpr Columns(Tbl, Cols...) {}
@@ -676,13 +1144,28 @@ struct Columns {
     static QString getTableName() {
         return Tbl::getTableName();
     }
+
+    static constexpr auto sqlColumnsText() {
+        return tstring_join(", "_T, Cols::name...);
+    }
+
+    static constexpr auto sqlTableText() {
+        return Tbl::name;
+    }
+
+    static std::tuple<> sqlBinds() {
+        return {};
+    }
 };
 
 template <typename Tbl, Expr::Expression... Cols>
 struct From {
-    Tbl const &table;
+    Tbl table;
     std::tuple<Cols...> columns;
 
+    // Columns of outer joined tables may be NULL
+    using Row = std::tuple<typename detail::projection_type<Tbl, Cols>::type...>;
+
     From(const Tbl &table, const Cols &... columns) :
         table(table), columns(columns...)
     {}
@@ -692,13 +1175,34 @@ struct From {
     }
 
     auto sqlSelectColumns() const {
-        return sql_join2(", ", Util::tuple_map(columns, [](auto c){return c.sqlExpression();}));
+        if constexpr ((ORM::Expr::StaticExpression<Cols> && ...))
+            return sql_static(sqlColumnsText(), sqlBinds());
+        else {
+            static_assert(std::tuple_size_v<decltype(table.sqlBinds())> == 0,
+                          "Joins with bound values need static column expressions");
+            return sql_join2(", ", Util::tuple_map(columns, [](auto c){return c.sqlExpression();}));
+        }
+    }
+
+    static constexpr auto sqlColumnsText() requires (ORM::Expr::StaticExpression<Cols> && ...) {
+        return tstring_join(", "_T, Cols::template sqlText<100>()...);
+    }
+
+    static constexpr auto sqlTableText() {
+        return Tbl::sqlTableText();
+    }
+
+    auto sqlBinds() const requires (ORM::Expr::StaticExpression<Cols> && ...) {
+        return std::tuple_cat(std::apply([](const auto &... c) {return std::tuple_cat(c.sqlBinds()...);}, columns),
+                              table.sqlBinds());
     }
 };
 
 
 // Invariants
 struct Stub {
+    using type = int;
+
     static QString getTableName() {
         return "abcdef";
     }
@@ -714,12 +1218,17 @@ struct Stub {
     static SQL<> sqlSelectConstraint() {
         return sql("");
     }
+
+    static std::tuple<> sqlBinds() {
+        return {};
+    }
 };
 
 static_assert(Source<From<Stub, Stub>>);
 static_assert(Constraint<Where<Stub>>);
 static_assert(Constraint<OrderBy<Stub>>);
 static_assert(Constraint<Limit>);
+static_assert(Constraint<GroupBy<Stub>>);
 static_assert(SQLQuery<Select<Stub>>);
 static_assert(Expr::Expression<Select<Stub>>);
 }
@@ -739,6 +1248,32 @@ auto select(From from, Cs... constraints) -> Sel::Select<From, Cs...> {
 // -----------------------------------------------------------------------
 // Layout classes
 
+namespace detail {
+template <typename Seq>
+struct sql_text_join_impl;
+
+template <typename... Ts>
+struct sql_text_join_impl<type_sequence<Ts...>> {
+    template <typename Sep, typename F>
+    static constexpr auto join(Sep sep, F f) {
+        return tstring_join(sep, f(Ts())...);
+    }
+
+    template <typename Sep>
+    static constexpr auto join_expressions(Sep sep) {
+        return tstring_join(sep, Ts::template sqlText<100>()...);
+    }
+};
+
+/**
+ * @brief Join the tstrings f returns for each type in a type_sequence
+ */
+template <typename Seq, typename Sep, typename F>
+constexpr auto sql_text_join(Sep sep, F f) {
+    return sql_text_join_impl<Seq>::join(sep, f);
+}
+}
+
 template <typename T>
 concept ColumnConstraint = requires() {
     {T::sqlCreateTableColumnProperty()} -> BoundSQL;
@@ -746,8 +1281,10 @@ concept ColumnConstraint = requires() {
 
 // Column Properties
 struct NotNull : public detail::property {
+    static constexpr auto sql_text = "NOT NULL"_T;
+
     static SQL<> sqlCreateTableColumnProperty() {
-        return QStringLiteral("NOT NULL");
+        return sql_static(sql_text);
     }
 };
 
@@ -756,8 +1293,10 @@ struct PrimaryKey;
 
 template <>
 struct PrimaryKey<> : public detail::property {
+    static constexpr auto sql_text = "PRIMARY KEY"_T;
+
     static SQL<> sqlCreateTableColumnProperty() {
-        return QStringLiteral("PRIMARY KEY");
+        return sql_static(sql_text);
     }
 };
 
@@ -766,8 +1305,10 @@ struct Unique;
 
 template <>
 struct Unique<> : public detail::property {
+    static constexpr auto sql_text = "UNIQUE"_T;
+
     static SQL<> sqlCreateTableColumnProperty() {
-        return QStringLiteral("UNIQUE");
+        return sql_static(sql_text);
     }
 };
 
@@ -799,16 +1340,26 @@ struct Column : Expr::detail::ExpressionBase<Column<NameTStr, T, Props...>, T>,
         return name.value;
     }
 
-    static auto sqlCreateTableColumn() {
-        auto s = sql_join(' ', Props::sqlCreateTableColumnProperty()...);
-        QStringList parts {name.value, schema_type<T>::value, s.query};
-        parts.removeAll(QStringLiteral());
-        return SQL{parts.join(' '), s.binds};
+    static constexpr auto sqlCreateTableColumnText() {
+        return tstring_join(" "_T, name, schema_type<T>::value, Props::sql_text...);
+    }
+
+    static SQL<> sqlCreateTableColumn() {
+        return sql_static(sqlCreateTableColumnText());
     }
 
     // Expression
+    template <int>
+    static constexpr auto sqlText() {
+        return name;
+    }
+
+    static std::tuple<> sqlBinds() {
+        return {};
+    }
+
     SQL<> sqlExpression(int=0) const {
-        return ORM::sql(getName());
+        return sql_static(name);
     }
 };
 
@@ -825,13 +1376,14 @@ struct Table {
     using Columns = typename Args::template filter<is_column>;
     using ColumnTypes = typename Columns::template type_map<detail::map_type_type>;
     using Constraints = typename Args::template filter<is_constraint>;
+    using Indexes = typename Args::template filter<is_index>;
 
     static constexpr auto name = NameTStr();
     static constexpr auto columns = typename Columns::tuple();
     static constexpr auto constraints = typename Constraints::tuple();
 
     static_assert(Columns::size > 0, "At least one column required");
-    static_assert(Args::size == Columns::size + Constraints::size, "Invalid arguments");
+    static_assert(Args::size == Columns::size + Constraints::size + Indexes::size, "Invalid arguments");
 
     constexpr Table() {}
     constexpr Table(NameTStr, Args...) {}
@@ -846,6 +1398,33 @@ struct Table {
         return Columns::template index<Col>;
     }
 
+    /**
+     * @brief Qualify a column with the table name, e.g. Chapter::table[Chapter::id]
+     */
+    template <typename Col>
+    constexpr auto operator [](Col) const {
+        static_assert(Columns::template contains<Col>, "Column not in table");
+        return Expr::Qualified<Table, Col>();
+    }
+
+    /**
+     * @brief The table itself as an expression, e.g. Search::table.ref().match(query)
+     */
+    static constexpr auto ref() {
+        return Expr::TableRef<Table>();
+    }
+
+    // Joins
+    template <typename Tbl, Expr::Expression Cond>
+    auto join(Tbl t, const Cond &cond) const {
+        return Sel::Join<Table, Tbl, Cond, false>(*this, t, cond);
+    }
+
+    template <typename Tbl, Expr::Expression Cond>
+    auto leftJoin(Tbl t, const Cond &cond) const {
+        return Sel::Join<Table, Tbl, Cond, true>(*this, t, cond);
+    }
+
     static QString getName() {
         return name.value;
     }
@@ -859,29 +1438,52 @@ struct Table {
         });
     }
 
-    static auto sqlCreateTable(bool if_not_exists = false) {
-        auto q = sql_join2(", ",
-                Util::tuple_map(columns, [] (auto col) {
-                    return col.sqlCreateTableColumn();
-                }),
-                Util::tuple_map(constraints, [] (auto ct) {
-                    return ct.sqlCreateTableConstraint();
-                }));
-        return SQL{
-            QStringLiteral("CREATE TABLE%3 %0 (%1);")
-                    .arg(getName()).arg(q.query)
-                    .arg(if_not_exists? " IF NOT EXISTS" : ""),
-            std::move(q.binds)
-        };
+    // Select::StaticSource
+    static constexpr auto sqlColumnsText() {
+        return detail::sql_text_join<Columns>(", "_T, [] (auto col) {return col.name;});
+    }
+
+    static constexpr auto sqlTableText() {
+        return name;
+    }
+
+    static std::tuple<> sqlBinds() {
+        return {};
+    }
+
+    template <bool IfNotExists = false>
+    static constexpr auto sqlCreateTableText() {
+        constexpr auto defs = [] {
+            constexpr auto cols = detail::sql_text_join<Columns>(", "_T, [] (auto col) {return col.sqlCreateTableColumnText();});
+            if constexpr (Constraints::size == 0)
+                return cols;
+            else
+                return tstring_join(", "_T, cols, detail::sql_text_join<Constraints>(", "_T, [] (auto ct) {return ct.sqlCreateTableConstraintText();}));
+        }();
+        if constexpr (IfNotExists)
+            return tstring_concat("CREATE TABLE IF NOT EXISTS "_T, name, " ("_T, defs, ");"_T);
+        else
+            return tstring_concat("CREATE TABLE "_T, name, " ("_T, defs, ");"_T);
+    }
+
+    static SQL<> sqlCreateTable(bool if_not_exists = false) {
+        if (if_not_exists)
+            return sql_static(sqlCreateTableText<true>());
+        else
+            return sql_static(sqlCreateTableText<false>());
+    }
+
+    /**
+     * @brief CREATE INDEX statements for the table's Index declarations, one per index
+     */
+    static std::vector<SQL<>> sqlCreateIndexes(bool if_not_exists = false) {
+        return create_indexes(if_not_exists, typename Indexes::tuple());
     }
 
     // Old Select
-    template <Expr::Expression Where, Sel::Constraint... Optionals>
-    static auto sqlSelect(Where w, Optionals... opts) {
-        static SQL<> templ = QStringLiteral("SELECT %0 FROM %1 WHERE")
-                .arg(getColumnNames().join(", "))
-                .arg(name.value);
-        return sql_join(" ", templ, w.sqlExpression(), opts.sqlSelectConstraint()..., SQL<>{";"});
+    template <Expr::Expression W, Sel::Constraint... Optionals>
+    static auto sqlSelect(W w, Optionals... opts) {
+        return Sel::Select{Table(), Sel::Where<W>(w), opts...}.sqlQuery();
     }
 
     template <Sel::Constraint... Opts>
@@ -891,13 +1493,16 @@ struct Table {
     }
 
     static Util::ORM::SQL<> sqlSelectAll() {
-        static Util::ORM::SQL<> q {
-            QStringLiteral("SELECT %0 FROM %1;")
-                    .arg(getColumnNames().join(", "))
-                    .arg(name.value),
-            {}
-        };
-        return q;
+        return sql_static(tstring_concat("SELECT "_T, sqlColumnsText(), " FROM "_T, name, ";"_T));
+    }
+
+private:
+    template <typename... Idxs>
+    static std::vector<SQL<>> create_indexes(bool if_not_exists, std::tuple<Idxs...>) {
+        if (if_not_exists)
+            return {sql_static(Idxs::template sqlCreateIndexText<Table, true>())...};
+        else
+            return {sql_static(Idxs::template sqlCreateIndexText<Table, false>())...};
     }
 };
 
@@ -916,8 +1521,12 @@ struct PrimaryKey : public detail::constraint {
         });
     }
 
+    static constexpr auto sqlCreateTableConstraintText() {
+        return tstring_concat("PRIMARY KEY ("_T, detail::sql_text_join<Columns>(", "_T, [] (auto c) {return c.name;}), ")"_T);
+    }
+
     static SQL<> sqlCreateTableConstraint() {
-        return QStringLiteral("PRIMARY KEY (%0)").arg(getColumnNames().join(", "));
+        return sql_static(sqlCreateTableConstraintText());
     }
 };
 
@@ -962,14 +1571,47 @@ struct ForeignKey : public detail::constraint {
         });
     }
 
+    static constexpr auto sqlCreateTableConstraintText() {
+        return tstring_concat("FOREIGN KEY ("_T, detail::sql_text_join<Columns>(", "_T, [] (auto c) {return c.name;}),
+                              ") REFERENCES "_T, References::Table::name,
+                              " ("_T, detail::sql_text_join<typename References::Columns>(", "_T, [] (auto c) {return c.name;}), ")"_T);
+    }
+
     static SQL<> sqlCreateTableConstraint() {
-        return QStringLiteral("FOREIGN KEY (%0) REFERENCES %1 (%2)")
-                .arg(getColumnNames().join(", "))
-                .arg(References::Table::getName())
-                .arg(References::getColumnNames().join(", "));
+        return sql_static(sqlCreateTableConstraintText());
     }
 };
 
+namespace detail {
+template <typename To>
+struct references_table {
+    template <typename C>
+    struct filter : std::false_type {};
+
+    template <typename... Args>
+    struct filter<ForeignKey<Args...>> : std::is_same<typename ForeignKey<Args...>::References::Table, To> {};
+};
+}
+
+template <typename From, typename To>
+inline constexpr bool has_foreign_key_to = From::Constraints::template filter<detail::references_table<To>::template filter>::size > 0;
+
+/**
+ * @brief The foreign key in table From that references table To
+ * There must be exactly one and it must span a single column.
+ */
+template <typename From, typename To>
+struct ForeignKeyTo {
+    using Matches = typename From::Constraints::template filter<detail::references_table<To>::template filter>;
+    static_assert(Matches::size == 1, "Expected exactly one foreign key referencing the table");
+
+    using Key = typename Matches::template get<0>;
+    static_assert(Key::Columns::size == 1, "Only single-column foreign keys are supported");
+
+    using Column = typename Key::Columns::template get<0>;
+    using Referenced = typename Key::References::Columns::template get<0>;
+};
+
 template <typename... Cols>
 struct Unique : public detail::constraint {
     using Columns = type_sequence<Cols...>;
@@ -986,8 +1628,61 @@ struct Unique : public detail::constraint {
         });
     }
 
+    static constexpr auto sqlCreateTableConstraintText() {
+        return tstring_concat("UNIQUE ("_T, detail::sql_text_join<Columns>(", "_T, [] (auto c) {return c.name;}), ")"_T);
+    }
+
     static SQL<> sqlCreateTableConstraint() {
-        return QStringLiteral("UNIQUE (%0)").arg(getColumnNames().join(", "));
+        return sql_static(sqlCreateTableConstraintText());
+    }
+};
+
+namespace detail {
+template <typename... Args>
+struct index_args {
+    using Name = void;
+    using Exprs = type_sequence<Args...>;
+};
+
+template <typename C, C... str, typename... Args>
+struct index_args<tstring<C, str...>, Args...> {
+    using Name = tstring<C, str...>;
+    using Exprs = type_sequence<Args...>;
+};
+}
+
+/**
+ * @brief Index on columns or expressions of a table
+ * Indexes aren't part of CREATE TABLE, see Table::sqlCreateIndexes(). They are named
+ * <table>_<columns>, expression indexes must pass a name as first argument:
+ * Index("recent"_T, Expr::datetime(timestamp))
+ */
+template <typename... Args>
+struct Index : public detail::index_tag {
+    using Name = typename detail::index_args<Args...>::Name;
+    using Exprs = typename detail::index_args<Args...>::Exprs;
+
+    static_assert(Exprs::size > 0, "At least one column or expression must be specified");
+    static_assert(!std::is_void_v<Name> || Exprs::template all<is_column>(), "Expression indexes must be named");
+
+    constexpr Index() {}
+    constexpr Index(Args...) {}
+
+    template <typename Tbl>
+    static constexpr auto sqlIndexName() {
+        if constexpr (std::is_void_v<Name>)
+            return tstring_concat(Tbl::name, "_"_T, detail::sql_text_join<Exprs>("_"_T, [] (auto c) {return c.name;}));
+        else
+            return tstring_concat(Tbl::name, "_"_T, Name());
+    }
+
+    template <typename Tbl, bool IfNotExists = false>
+    static constexpr auto sqlCreateIndexText() {
+        constexpr auto exprs = detail::sql_text_join_impl<Exprs>::join_expressions(", "_T);
+        if constexpr (IfNotExists)
+            return tstring_concat("CREATE INDEX IF NOT EXISTS "_T, sqlIndexName<Tbl>(), " ON "_T, Tbl::name, " ("_T, exprs, ");"_T);
+        else
+            return tstring_concat("CREATE INDEX "_T, sqlIndexName<Tbl>(), " ON "_T, Tbl::name, " ("_T, exprs, ");"_T);
     }
 };
 
@@ -1012,7 +1707,7 @@ public:
     }
 
     RowStorage(stor_type &&tup, bool is_new=false) :
-        data(tup)
+        data(std::move(tup))
     {
         dirty.fill(is_new);
     }
@@ -1031,6 +1726,10 @@ public:
         dirty.fill(false);
     }
 
+    inline void set_dirty(const flag_type &flags) {
+        dirty = flags;
+    }
+
     // Get stuff
     template <typename Col>
     inline auto get() const
@@ -1061,6 +1760,10 @@ public:
     inline stor_type get() {
         return data;
     }
+
+    inline stor_type take() && {
+        return std::move(data);
+    }
 };
 
 
@@ -1109,6 +1812,7 @@ public:
 #define ORM_OBJECT(self, make_table, name, ...) \
     static constexpr auto table = make_table(name ##_T, __VA_ARGS__); \
     using Table = typename std::decay_t<decltype(make_table(name ##_T, __VA_ARGS__))>; \
+    using Row = typename Table::ColumnTypes::tuple; \
 private: \
     ::Midoku::Util::ORM::RowStorage<Table> row; \
     friend class ::Midoku::Util::ORM::Base<self>; \
@@ -0,0 +1,202 @@
+#pragma once
+
+#include "result.h"
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <utility>
+
+
+namespace Midoku::Util {
+
+template <typename R>
+class Task;
+
+namespace detail {
+template <typename R>
+struct is_result : std::false_type {};
+
+template <typename T, typename E>
+struct is_result<Result<T, E>> : std::true_type {};
+}
+
+/**
+ * @brief Coroutine producing a Result<T, E>
+ * Runs eagerly until the first suspension. Inside the coroutine, co_await on a Result
+ * returns its value, or ends the coroutine with its error. Other awaitables, like
+ * DatabaseWorker::run() and Tasks, resume with a Result to be co_awaited in turn:
+ *
+ *     auto r = co_await worker.run(job, this);
+ *     auto row = co_await std::move(r);
+ *
+ * Keep lambdas out of co_await expressions: GCC 12 destroys such temporaries twice.
+ * A Task that is destroyed before finishing keeps running, its result is dropped.
+ */
+template <typename R>
+class Task
+{
+    static_assert(detail::is_result<R>::value, "Task<R>: R must be a Util::Result");
+
+public:
+    struct promise_type;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    struct promise_type {
+        std::optional<R> result;
+        // Awaiting coroutine, if any
+        std::coroutine_handle<> continuation;
+        // Nobody holds the Task anymore, destroy the frame when done
+        bool detached = false;
+        std::function<void(R &&)> on_done;
+
+        Task get_return_object() {
+            return Task(handle_type::from_promise(*this));
+        }
+
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+
+        auto final_suspend() noexcept {
+            struct Final {
+                bool await_ready() noexcept {
+                    return false;
+                }
+
+                std::coroutine_handle<> await_suspend(handle_type h) noexcept {
+                    return h.promise().complete();
+                }
+
+                void await_resume() noexcept {}
+            };
+            return Final{};
+        }
+
+        template <typename U>
+        void return_value(U &&v) {
+            result.emplace(std::forward<U>(v));
+        }
+
+        void unhandled_exception() {
+            std::terminate();
+        }
+
+        /**
+         * @brief Finish with an error, from a suspension point
+         * @return The coroutine to run next
+         */
+        template <typename E>
+        std::coroutine_handle<> fail(E &&e) {
+            typename R::error_type err(std::forward<E>(e));
+            result.emplace(Err(std::move(err)));
+            return complete();
+        }
+
+        std::coroutine_handle<> complete() noexcept {
+            if (continuation)
+                return continuation;
+            if (detached) {
+                auto r = std::move(*result);
+                auto done = std::move(on_done);
+                handle_type::from_promise(*this).destroy();
+                if (done)
+                    done(std::move(r));
+            }
+            return std::noop_coroutine();
+        }
+
+        // co_await Result
+        template <typename T, typename E>
+        auto await_transform(Result<T, E> r) {
+            struct Try {
+                Result<T, E> r;
+
+                bool await_ready() const noexcept {
+                    return static_cast<bool>(r);
+                }
+
+                std::coroutine_handle<> await_suspend(handle_type h) {
+                    return h.promise().fail(std::move(r).error());
+                }
+
+                auto await_resume() {
+                    if constexpr (!std::is_void_v<T>)
+                        return std::move(r).value();
+                }
+            };
+            return Try{std::move(r)};
+        }
+
+        template <typename A>
+        A &&await_transform(A &&a) {
+            return std::forward<A>(a);
+        }
+    };
+
+private:
+    handle_type h;
+
+    explicit Task(handle_type h) :
+        h(h)
+    {}
+
+public:
+    Task(Task &&o) :
+        h(std::exchange(o.h, {}))
+    {}
+
+    Task(const Task &) = delete;
+
+    ~Task() {
+        detach();
+    }
+
+    bool done() const {
+        return h && h.promise().result.has_value();
+    }
+
+    /**
+     * @brief Let the coroutine finish on its own
+     * @param on_done   Called with the result once it is available
+     */
+    void detach(std::function<void(R &&)> on_done = {}) {
+        if (!h)
+            return;
+
+        auto &p = h.promise();
+        if (p.result) {
+            auto r = std::move(*p.result);
+            h.destroy();
+            if (on_done)
+                on_done(std::move(r));
+        } else {
+            p.detached = true;
+            p.on_done = std::move(on_done);
+        }
+        h = {};
+    }
+
+    // co_await Task, resumes with its Result
+    auto operator co_await() && {
+        struct Awaiter {
+            Task task;
+
+            bool await_ready() const noexcept {
+                return task.done();
+            }
+
+            void await_suspend(std::coroutine_handle<> awaiting) {
+                task.h.promise().continuation = awaiting;
+            }
+
+            R await_resume() {
+                return std::move(*task.h.promise().result);
+            }
+        };
+        return Awaiter{std::move(*this)};
+    }
+};
+
+}
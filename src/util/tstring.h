@@ -21,16 +21,29 @@ constexpr  const C  tstring<C, str...>::value[sizeof...(str)+1];
 
 
 // concat
-template <typename C, C... str1, C...str2>
-constexpr tstring<C, str1..., str2...> tstring_concat(tstring<C, str1...>, tstring<C, str2...>)
+template <typename C, C... str>
+constexpr tstring<C, str...> tstring_concat(tstring<C, str...> s)
+{
+    return s;
+}
+
+template <typename C, C... str1, C...str2, typename... Rest>
+constexpr auto tstring_concat(tstring<C, str1...>, tstring<C, str2...>, Rest... rest)
 {
-    return tstring<C, str1..., str2...>();
+    return tstring_concat(tstring<C, str1..., str2...>(), rest...);
+}
+
+// join
+template <typename C, C... sep>
+constexpr tstring<C> tstring_join(tstring<C, sep...>)
+{
+    return {};
 }
 
-template <typename C, C... str1, C...str2, C...str3>
-constexpr tstring<C, str1..., str2..., str3...> tstring_concat(tstring<C, str1...>, tstring<C, str2...>, tstring<C, str3...>)
+template <typename C, C... sep, typename First, typename... Rest>
+constexpr auto tstring_join(tstring<C, sep...> s, First first, Rest... rest)
 {
-    return tstring<C, str1..., str2..., str3...>();
+    return tstring_concat(first, tstring_concat(s, rest)...);
 }
 
 